@@ -0,0 +1,140 @@
+when compileOption("threads"):
+  import std/locks
+
+## Buffered file output with write-behind.
+##
+## Writes go into an in-memory buffer.  When it fills up, the whole
+## buffer is handed over to a writer thread that writes it to the file
+## while the caller goes on filling a second buffer, so the simulator
+## thread never waits for the file system unless it fills a buffer
+## before the writer is done with the previous one.
+##
+## Writers that format their output in place use `reserve` to get room
+## in the buffer, and `advance` to commit what they wrote there.
+##
+## Without threads (make NIM_THREADS=0) a full buffer is written out
+## straight away instead; the interface is the same.
+
+type
+  AsyncFileObj = object
+    file: File
+    size: int                          ## capacity of each buffer
+    fill: ptr UncheckedArray[char]     ## buffer being filled
+    pos: int                           ## bytes used in `fill`
+    when compileOption("threads"):
+      spare: ptr UncheckedArray[char]  ## buffer being written out, or free
+      pending: int                     ## bytes of `spare` to be written, 0 if it is free
+      closing: bool                    ## tells the writer to exit
+      lock: Lock
+      cond: Cond
+      writer: Thread[ptr AsyncFileObj]
+
+  AsyncFile* = ptr AsyncFileObj
+
+when compileOption("threads"):
+  proc writerLoop(f: ptr AsyncFileObj) {.thread.} =
+    ## The writer thread: write out each buffer handed over, until the
+    ## file is closed.
+    acquire(f.lock)
+    while true:
+      while f.pending == 0 and not f.closing:
+        wait(f.cond, f.lock)
+      if f.pending == 0:
+        break
+      let
+        n = f.pending
+      release(f.lock)
+      discard f.file.writeBuffer(f.spare, n)
+      acquire(f.lock)
+      f.pending = 0
+      broadcast(f.cond)
+    release(f.lock)
+
+proc openAsyncFile*(path: string; bufferSize = 4 shl 20): AsyncFile =
+  ## Open `path` for writing, with buffers of `bufferSize` bytes.
+  ## Returns nil if the file cannot be opened.
+  var
+    file: File
+  if not open(file, path, fmWrite):
+    return nil
+  result = createShared(AsyncFileObj)
+  result.file = file
+  result.size = bufferSize
+  result.fill = cast[ptr UncheckedArray[char]](allocShared(bufferSize))
+  when compileOption("threads"):
+    result.spare = cast[ptr UncheckedArray[char]](allocShared(bufferSize))
+    initLock(result.lock)
+    initCond(result.cond)
+    createThread(result.writer, writerLoop, result)
+
+proc handOver(f: AsyncFile) =
+  ## Pass the filled part of the buffer on to be written out, and
+  ## start again with an empty buffer.
+  when compileOption("threads"):
+    acquire(f.lock)
+    while f.pending != 0:
+      wait(f.cond, f.lock)
+    swap(f.fill, f.spare)
+    f.pending = f.pos
+    broadcast(f.cond)
+    release(f.lock)
+  else:
+    discard f.file.writeBuffer(f.fill, f.pos)
+  f.pos = 0
+
+proc reserve*(f: AsyncFile; n: int): ptr UncheckedArray[char] {.inline.} =
+  ## Return a pointer to `n` free bytes at the end of the buffer, which
+  ## must be no bigger than the buffer size.
+  if f.pos + n > f.size:
+    f.handOver()
+  return cast[ptr UncheckedArray[char]](addr f.fill[f.pos])
+
+proc advance*(f: AsyncFile; n: int) {.inline.} =
+  ## Commit `n` bytes written at the pointer returned by `reserve`.
+  f.pos += n
+
+proc write*(f: AsyncFile; data: pointer; len: int) =
+  ## Append `len` bytes from `data`.
+  var
+    done = 0
+  while done < len:
+    if f.pos == f.size:
+      f.handOver()
+    let
+      n = min(len - done, f.size - f.pos)
+    copyMem(addr f.fill[f.pos], cast[pointer](cast[uint](data) + done.uint), n)
+    f.pos += n
+    done += n
+
+proc write*(f: AsyncFile; s: string) =
+  ## Append the string `s`.
+  if s.len > 0:
+    f.write(unsafeAddr s[0], s.len)
+
+proc flush*(f: AsyncFile) =
+  ## Write out everything so far, and wait until it is in the file.
+  if f.pos > 0:
+    f.handOver()
+  when compileOption("threads"):
+    acquire(f.lock)
+    while f.pending != 0:
+      wait(f.cond, f.lock)
+    release(f.lock)
+  f.file.flushFile()
+
+proc close*(f: AsyncFile) =
+  ## Write out everything, stop the writer thread, close the file and
+  ## free the buffers.
+  f.flush()
+  when compileOption("threads"):
+    acquire(f.lock)
+    f.closing = true
+    broadcast(f.cond)
+    release(f.lock)
+    joinThread(f.writer)
+    deinitCond(f.cond)
+    deinitLock(f.lock)
+    deallocShared(f.spare)
+  f.file.close()
+  deallocShared(f.fill)
+  freeShared(f)
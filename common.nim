@@ -24,3 +24,29 @@ proc getUserData*(systfHandle: VpiHandle): VpiUserDataRef =
     # storage that is unique for each task/func instance.
     discard systfHandle.vpi_put_userdata(cast[pointer](vpiUserDataRef))
   return vpiUserDataRef
+
+iterator simArgs(): string =
+  ## Yield the simulator's command line arguments.
+  var
+    info: s_vpi_vlog_info
+  if vpi_get_vlog_info(addr info) != 0:
+    let
+      argv = cast[cstringArray](info.argv)
+    for i in 0 ..< info.argc.int:
+      yield $argv[i]
+
+proc plusarg*(name: string): string =
+  ## Return the value of the plusarg +`name`=<value>, or "".
+  let
+    prefix = "+" & name & "="
+  for arg in simArgs():
+    if arg.len > prefix.len and arg[0 ..< prefix.len] == prefix:
+      return arg[prefix.len .. ^1]
+  return ""
+
+proc hasPlusarg*(name: string): bool =
+  ## True if the plusarg +`name` was given, with or without a value.
+  for arg in simArgs():
+    if arg == "+" & name or (arg.len > name.len + 1 and arg[0 .. name.len + 1] == "+" & name & "="):
+      return true
+  return false
@@ -1,5 +1,6 @@
 import std/[strformat]
 import svvpi
+import ../output_sink
 
 when defined(inefficient):
   static:
@@ -12,7 +13,8 @@ when defined(inefficient):
         argCount = 0
       for _, _ in systfHandle.vpiArgs(checkError = true):
         inc argCount
-      vpiEcho &"{tfName} on line {vpi_get(vpiLineNo, systfHandle)} has {argCount} arguments."
+      echoLine &"{tfName} on line {vpi_get(vpiLineNo, systfHandle)} has {argCount} arguments."
+      flushOutput()
 
 else:
   import ../common
@@ -20,7 +22,8 @@ else:
   vpiDefine task count_args:
     ## Count the number of arguments to the calling VPI task/function.
     calltf:
-      vpiEcho &"{tfName} on line {vpi_get(vpiLineNo, systfHandle)} has {systfHandle.getUserData().args.len} arguments."
+      echoLine &"{tfName} on line {vpi_get(vpiLineNo, systfHandle)} has {systfHandle.getUserData().args.len} arguments."
+      flushOutput()
 
 
 setVlogStartupRoutines(count_args)
@@ -0,0 +1,238 @@
+import std/[strformat, tables]
+import svvpi
+
+## Per-definition layout of the signals of a scope.
+##
+## The instances of one module definition, with the same parameter
+## values, have the same nets and variables, with the same names, types
+## and widths.  Asking the simulator for all of that again for every
+## instance (4096 identical cache banks ..) is wasted work, so the
+## layout of a definition is looked up on its first instance only, and
+## kept under a key made of its vpiDefName, the values of its
+## parameters, and the types and widths its type parameters resolve
+## to.  Every later instance costs a walk of its parameters,
+## and binding its handles: one iteration over its nets and variables,
+## in the same order as in the layout, with no other VPI call per
+## signal.
+##
+## Scopes that have no definition of their own (generate blocks, named
+## blocks, tasks, ..) get a layout of their own, which is not cached.
+## Neither is the layout of an instance with a type parameter whose
+## width the simulator does not give, since instances that differ only
+## in that parameter could have signals of different widths, nor a
+## layout whose handles fail to bind, i.e. an instance with a different
+## number of signals than its definition's layout.
+##
+## Arrays and memories are kept with the width of one word as their
+## size, and their number of words.  Net arrays are only counted (in
+## nNetArrays, netBits and arrayWords), and are not in the signals.
+
+type
+  SignalKind* = enum
+    skNet, skVariable
+
+  SignalLayout* = object
+    kind*: SignalKind
+    sigType*: int32      ## vpiType
+    size*: int32         ## vpiSize, 0 if the simulator gave none; per word for arrays
+    words*: int32        ## number of words of arrays (and memories), 0 for others
+    format*: cint        ## vpiVectorVal, or vpiRealVal for real variables
+    nameStart, nameLen: int32  ## vpiName, in `names`
+
+  DefLayout* = ref object
+    id*: int             ## index in the cache, -1 for layouts not cached
+    defName*: string
+    signals*: seq[SignalLayout]  ## nets first, then variables, in iteration order
+    nNets*: int
+    netBits*, variableBits*: int  ## total width, of all the words of arrays
+    nNetArrays*: int     ## net arrays, which are not in `signals`
+    arrayWords*: int     ## words of all the arrays, net arrays included
+    names: string        ## the signals' names, back to back
+
+  DefLayoutStats* = object
+    layouts*: int        ## layouts built, cached or not
+    instances*: int      ## instances whose layout came from the cache
+
+var
+  layouts: Table[string, DefLayout]  ## key -> layout
+  layoutCount: int
+  stats: DefLayoutStats
+
+proc hasNets(scope: VpiHandle): bool {.inline.} =
+  return vpi_get(vpiType, scope) in {vpiModule, vpiInterface, vpiGenScope}
+
+proc hasDefinition(scope: VpiHandle): bool {.inline.} =
+  return vpi_get(vpiType, scope) in {vpiModule, vpiInterface}
+
+proc layoutKey(scope: VpiHandle; key: var string): bool =
+  ## Put in `key` the vpiDefName of `scope`, the name and value of each
+  ## of its parameters, and the type and width of each of its type
+  ## parameters.  False if the layout of `scope` cannot be cached under
+  ## that key, because the width of a type parameter is not known.
+  key = $vpi_get_str(vpiDefName, scope)
+  result = true
+  for typeParam, _ in scope.vpiHandles2(vpiTypeParameter):
+    let
+      typespec = vpi_handle(vpiTypespec, typeParam)
+      size = if typespec == nil: 0 else: vpi_get(vpiSize, typespec)
+    if size <= 0:
+      result = false
+      continue
+    key.add('\0')
+    key.add(vpi_get_str(vpiName, typeParam))
+    key.add(&":{vpi_get(vpiType, typespec)}:{size}")
+  if not result:
+    return
+  for param, _ in scope.vpiHandles2(vpiParameter):
+    key.add('\0')
+    key.add(vpi_get_str(vpiName, param))
+    key.add('=')
+    var
+      value = s_vpi_value()
+    case vpi_get(vpiConstType, param)
+    of vpiRealConst:
+      value.format = vpiRealVal
+      vpi_get_value(param, addr value)
+      key.add($value.value.real)
+    of vpiStringConst:
+      value.format = vpiStringVal
+      vpi_get_value(param, addr value)
+      key.add(value.value.str)
+    else:
+      value.format = vpiHexStrVal
+      vpi_get_value(param, addr value)
+      key.add(value.value.str)
+
+proc wordSize(arrHandle: VpiHandle; sigType: int): int =
+  ## Width of the words of the array `arrHandle`, from its first word.
+  let
+    iter = vpi_iterate(if sigType == vpiNetArray: vpiNet
+                       elif sigType == vpiMemory: vpiMemoryWord
+                       else: vpiReg,
+                       arrHandle)
+  if iter == nil:
+    return 0
+  let
+    word = vpi_scan(iter)
+  if word != nil:
+    result = max(vpi_get(vpiSize, word), 0)
+    discard vpi_release_handle(word)
+    discard vpi_release_handle(iter)
+
+proc addSignal(layout: DefLayout; kind: SignalKind; sigHandle: VpiHandle) =
+  let
+    sigType = vpi_get(vpiType, sigHandle)
+  var
+    size = max(vpi_get(vpiSize, sigHandle), 0)
+    words = 0
+  if sigType in {vpiRegArray, vpiMemory, vpiArrayVar}:
+    words = size
+    size = wordSize(sigHandle, sigType)
+    layout.arrayWords += words
+  layout.signals.add(SignalLayout(kind: kind,
+                                  sigType: sigType.int32,
+                                  size: size.int32,
+                                  words: words.int32,
+                                  format: if sigType == vpiRealVar: vpiRealVal.cint else: vpiVectorVal.cint,
+                                  nameStart: layout.names.len.int32))
+  layout.names.add(vpi_get_str(vpiName, sigHandle))
+  layout.signals[^1].nameLen = layout.names.len.int32 - layout.signals[^1].nameStart
+  if kind == skNet:
+    inc layout.nNets
+    layout.netBits += size
+  else:
+    layout.variableBits += size * max(words, 1)
+
+proc buildLayout(scope: VpiHandle; handles: var seq[VpiHandle]): DefLayout =
+  ## Look up the layout of `scope`, and put its handles in `handles`.
+  result = DefLayout(id: -1)
+  if scope.hasDefinition:
+    result.defName = $vpi_get_str(vpiDefName, scope)
+  handles.setLen(0)
+  if scope.hasNets:
+    for netHandle, _ in scope.vpiHandles2(vpiNet):
+      result.addSignal(skNet, netHandle)
+      handles.add(netHandle)
+  for varHandle, _ in scope.vpiHandles2(vpiVariables):
+    result.addSignal(skVariable, varHandle)
+    handles.add(varHandle)
+  if scope.hasNets:
+    # Only counted, for the sizes of the design.
+    for arrHandle, _ in scope.vpiHandles2(vpiNetArray):
+      let
+        words = max(vpi_get(vpiSize, arrHandle), 0)
+      inc result.nNetArrays
+      result.arrayWords += words
+      result.netBits += words * wordSize(arrHandle, vpiNetArray)
+  inc stats.layouts
+
+proc bindHandles*(layout: DefLayout; scope: VpiHandle; handles: var seq[VpiHandle]): bool =
+  ## Put the handles of the signals of `scope`, an instance of `layout`,
+  ## in `handles`, in layout order.  False if `scope` does not have as
+  ## many nets and variables as the layout.
+  handles.setLen(0)
+  if scope.hasNets:
+    for netHandle, _ in scope.vpiHandles2(vpiNet):
+      handles.add(netHandle)
+    if handles.len != layout.nNets:
+      return false
+  for varHandle, _ in scope.vpiHandles2(vpiVariables):
+    handles.add(varHandle)
+  return handles.len == layout.signals.len
+
+proc addLayout(key: string; scope: VpiHandle; handles: var seq[VpiHandle]): DefLayout =
+  ## Build the layout of `scope`, and cache it under `key`.
+  result = buildLayout(scope, handles)
+  result.id = layoutCount
+  inc layoutCount
+  layouts[key] = result
+
+proc getLayout*(scope: VpiHandle; handles: var seq[VpiHandle]): DefLayout =
+  ## The layout of `scope`, from the cache if an instance of the same
+  ## definition and parameters has been seen before.  The handles of
+  ## the signals of `scope` are put in `handles`, in layout order.
+  var
+    key: string
+  if not scope.hasDefinition or not layoutKey(scope, key):
+    return buildLayout(scope, handles)
+  result = layouts.getOrDefault(key)
+  if result == nil:
+    return addLayout(key, scope, handles)
+  if not result.bindHandles(scope, handles):
+    return buildLayout(scope, handles)
+  inc stats.instances
+
+proc getLayout*(scope: VpiHandle): DefLayout =
+  ## The layout of `scope`, for when its handles are not needed: an
+  ## instance of a cached layout then costs no more than its key.
+  var
+    handles: seq[VpiHandle]
+    key: string
+  if not scope.hasDefinition or not layoutKey(scope, key):
+    return buildLayout(scope, handles)
+  result = layouts.getOrDefault(key)
+  if result == nil:
+    return addLayout(key, scope, handles)
+  inc stats.instances
+
+proc len*(layout: DefLayout): int {.inline.} =
+  ## Number of signals.
+  return layout.signals.len
+
+proc addName*(buf: var string; layout: DefLayout; i: int) =
+  ## Append the name of signal `i`.
+  let
+    s = layout.signals[i]
+  if s.nameLen > 0:
+    let
+      start = buf.len
+    buf.setLen(start + s.nameLen.int)
+    copyMem(addr buf[start], unsafeAddr layout.names[s.nameStart.int], s.nameLen.int)
+
+proc name*(layout: DefLayout; i: int): string =
+  ## Name of signal `i`.
+  result.addName(layout, i)
+
+proc defLayoutStats*(): DefLayoutStats =
+  ## Counts of layouts built, and of instances that reused one.
+  return stats
@@ -0,0 +1,219 @@
+import std/[strformat, times]
+import svvpi
+import ../async_file
+
+## $fast_dumpvars(scope, file) dumps all the nets and variables found
+## directly in `scope` (the same vpiNet/vpiVariables iteration as
+## $show_all_signals) to the VCD file `file`, from the time of the call
+## to the end of the simulation.
+##
+## Every signal gets its own value-change callback, which formats the
+## new value straight into a large write-behind buffer (see
+## ../async_file.nim); a writer thread writes the full buffers to the
+## file.  Identifier codes are the shortest possible, base-94 strings
+## of printable characters.
+
+type
+  DumpedSignal = object
+    obj: VpiHandle
+    code: string     ## VCD identifier code
+    size: int        ## number of bits
+    isReal: bool
+    dump: int        ## index of the dump it belongs to
+
+  Dump = object
+    file: AsyncFile
+    lastTime: int64  ## time of the last "#time" line
+
+const
+  vcdBitChars = ['0', '1', 'z', 'x']  ## indexed by aval bit + 2 * bval bit
+
+var
+  dumps: seq[Dump]
+  signals: seq[DumpedSignal]
+  endCallback: VpiHandle
+
+proc idCode(n: int): string =
+  ## The `n`th VCD identifier code: "!", "\"", .. "~", "!!", "\"!", ..
+  var
+    n = n
+  while true:
+    result.add(chr(ord('!') + n mod 94))
+    n = n div 94
+    if n == 0:
+      break
+    dec n
+
+proc writeTime(d: var Dump; time: int64) =
+  ## Start a new time step in the dump, unless it is already at `time`.
+  if time != d.lastTime:
+    d.lastTime = time
+    d.file.write(&"#{time}\n")
+
+proc writeValue(sig: DumpedSignal; valuePtr: p_vpi_value) =
+  ## Format the value of a signal, as obtained from VPI, straight into
+  ## the dump's buffer.
+  let
+    f = dumps[sig.dump].file
+  if sig.isReal:
+    f.write(&"r{valuePtr.value.real} {sig.code}\n")
+    return
+  let
+    vec = cast[ptr UncheckedArray[s_vpi_vecval]](valuePtr.value.vector)
+    n = sig.size + sig.code.len + 3
+    buf = f.reserve(n)
+  var
+    pos = 0
+  if sig.size > 1:
+    buf[0] = 'b'
+    pos = 1
+  for i in countdown(sig.size - 1, 0):
+    let
+      word = vec[i shr 5]
+      bit = i and 31
+    buf[pos] = vcdBitChars[((cast[uint32](word.aval) shr bit) and 1) or
+                           (((cast[uint32](word.bval) shr bit) and 1) shl 1)]
+    inc pos
+  if sig.size > 1:
+    buf[pos] = ' '
+    inc pos
+  copyMem(addr buf[pos], unsafeAddr sig.code[0], sig.code.len)
+  pos += sig.code.len
+  buf[pos] = '\n'
+  f.advance(pos + 1)
+
+proc vcdCallback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## Value-change callback of a dumped signal, whose index is in the
+  ## callback's user_data.
+  let
+    i = cast[int](cbDataPtr.user_data)
+  dumps[signals[i].dump].writeTime((cbDataPtr.time.high.int64 shl 32) or cbDataPtr.time.low.int64)
+  writeValue(signals[i], cbDataPtr.value)
+  return vpiCbSuccess
+
+proc endOfSimCallback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## Write out and close all the dumps.
+  for d in dumps:
+    d.file.close()
+  dumps.setLen(0)
+  return vpiCbSuccess
+
+proc timescale(): string =
+  ## The simulation precision as a VCD time scale, e.g. "10ps".
+  const
+    units = ["s", "ms", "us", "ns", "ps", "fs"]
+  let
+    precision = vpi_get(vpiTimePrecision, nil)  # e.g. -11 for 10ps
+    unitIndex = (2 - precision) div 3           # -11 -> 4 (ps)
+    magnitude = ["1", "10", "100"][precision + 3 * unitIndex]
+  return magnitude & units[unitIndex]
+
+proc varType(obj: VpiHandle): string =
+  ## The VCD variable type of a net or variable, or "" if it cannot
+  ## be dumped.
+  case vpi_get(vpiType, obj)
+  of vpiNet: "wire"
+  of vpiReg, vpiLogicVar, vpiBitVar, vpiByteVar, vpiShortIntVar, vpiIntVar,
+     vpiLongIntVar, vpiEnumVar: "reg"
+  of vpiIntegerVar: "integer"
+  of vpiTimeVar: "time"
+  of vpiRealVar: "real"
+  else: ""
+
+proc scopeType(scope: VpiHandle): string =
+  ## The VCD scope type of a scope.
+  case vpi_get(vpiType, scope)
+  of vpiTask: "task"
+  of vpiFunction: "function"
+  of vpiNamedBegin: "begin"
+  of vpiNamedFork: "fork"
+  else: "module"
+
+vpiDefine task fast_dumpvars:
+  compiletf:
+    systfHandle.vpiNumArgCheck(2)
+    for argIndex, argHandle in systfHandle.vpiArgs:
+      let
+        argType = vpi_get(vpiType, argHandle)
+      if argIndex == 0 and argType notin {vpiModule, vpiTask, vpiFunction, vpiNamedBegin, vpiNamedFork}:
+        vpiException &"Arg {argIndex} must be a scope instance, but its type was {argType}"
+
+  calltf:
+    var
+      scope, fileArg: VpiHandle
+    for argIndex, argHandle in systfHandle.vpiArgs:
+      if argIndex == 0:
+        scope = argHandle
+      else:
+        fileArg = argHandle
+    var
+      fileName = s_vpi_value(format: vpiStringVal)
+    vpi_get_value(fileArg, addr fileName)
+    let
+      f = openAsyncFile($fileName.value.str)
+    if f == nil:
+      vpiEcho &"*E,FAST_DUMPVARS: could not open {fileName.value.str} for writing"
+      return
+
+    let
+      dumpIndex = dumps.len
+    var
+      start = s_vpi_time(`type`: vpiSimTime)
+    vpi_get_time(nil, addr start)
+    dumps.add(Dump(file: f, lastTime: -1))
+
+    f.write(&"$date\n  {now()}\n$end\n")
+    f.write("$version\n  $fast_dumpvars (nim-systemverilog-vpi)\n$end\n")
+    f.write(&"$timescale\n  {timescale()}\n$end\n")
+    f.write(&"$scope {scopeType(scope)} {vpi_get_str(vpiName, scope)} $end\n")
+
+    # Nets can only exist if scope is a module.
+    # Note that IEEE 1800-2005 onwards, vpiVariables includes vpiReg
+    # and vpiRegArrays.
+    let
+      sigTypes = if vpi_get(vpiType, scope) == vpiModule: @[vpiNet.cint, vpiVariables] else: @[vpiVariables.cint]
+      firstSignal = signals.len
+    for sigType in sigTypes:
+      for sigHandle, _ in scope.vpiHandles2(sigType):
+        let
+          kind = varType(sigHandle)
+        if kind.len == 0:
+          continue
+        let
+          sig = DumpedSignal(obj: sigHandle,
+                             code: idCode(signals.len - firstSignal),
+                             size: if kind == "real": 64 else: vpi_get(vpiSize, sigHandle),
+                             isReal: kind == "real",
+                             dump: dumpIndex)
+        f.write(&"$var {kind} {sig.size} {sig.code} {vpi_get_str(vpiName, sigHandle)} $end\n")
+        signals.add(sig)
+    f.write("$upscope $end\n$enddefinitions $end\n")
+
+    # Initial values, then a callback on every signal for the changes.
+    dumps[dumpIndex].writeTime((start.high.int64 shl 32) or start.low.int64)
+    f.write("$dumpvars\n")
+    for i in firstSignal ..< signals.len:
+      var
+        time_s = s_vpi_time(`type`: vpiSimTime)
+        value_s = s_vpi_value(format: if signals[i].isReal: vpiRealVal else: vpiVectorVal)
+      vpi_get_value(signals[i].obj, addr value_s)
+      writeValue(signals[i], addr value_s)
+      var
+        cbData = s_cb_data(reason: cbValueChange,
+                           cb_rtn: vcdCallback,
+                           obj: signals[i].obj,
+                           time: addr time_s,
+                           value: addr value_s,
+                           user_data: cast[cstring](i))
+      discard vpi_register_cb(addr cbData)
+    f.write("$end\n")
+    vpiEcho &"$fast_dumpvars: dumping {signals.len - firstSignal} signals of {vpi_get_str(vpiFullName, scope)} to {fileName.value.str}"
+
+    if endCallback == nil:
+      var
+        cbData = s_cb_data(reason: cbEndOfSimulation,
+                           cb_rtn: endOfSimCallback)
+      endCallback = vpi_register_cb(addr cbData)
+
+
+setVlogStartupRoutines(fast_dumpvars)
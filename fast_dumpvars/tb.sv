@@ -0,0 +1,79 @@
+//-----------------------------------------------------------------------------
+// File:        tb.sv
+// Description: Test bench for $fast_dumpvars
+//-----------------------------------------------------------------------------
+// Counters of different widths, an integer, a real and two wide buses
+// built from N generated counters all change on every clock, and all
+// the signals of the top scope get dumped to a VCD file: by
+// $fast_dumpvars, or by the simulator's own $dumpvars when
+// BUILTIN_DUMP is defined.  "make bench" times the two.
+//-----------------------------------------------------------------------------
+
+`timescale 1ns / 1ps
+
+`ifndef N_SIGNALS
+  `define N_SIGNALS 2000
+`endif
+`ifndef STEPS
+  `define STEPS 10000
+`endif
+
+module top;
+
+  localparam int N = `N_SIGNALS;
+
+  bit clk;
+  integer count;
+  real level;
+  logic       c1 = 0;
+  logic [2:0] c3 = 0;
+  logic [7:0] c8 = 0;
+  logic [12:0] c13 = 0;
+  logic [15:0] c16 = 0;
+  logic [31:0] c32 = 0;
+  logic [47:0] c48 = 0;
+  logic [63:0] c64 = 0;
+  wire [N-1:0] flags, carries;
+
+  generate
+    genvar i;
+    for (i=0; i<N; i++) begin: g
+      // Widths 1 to 64.
+      logic [i % 64:0] c = i;
+      always @(posedge clk)
+        c <= c + i + 1;
+      assign flags[i] = c[0];
+      assign carries[i] = c[i % 64];
+    end
+  endgenerate
+
+  always @(posedge clk) begin
+    count <= count + 1;
+    level <= level + 0.25;
+    c1 <= ~c1;
+    c3 <= c3 + 1;
+    c8 <= c8 + 3;
+    c13 <= c13 + 7;
+    c16 <= c16 + 11;
+    c32 <= c32 * 5 + 1;
+    c48 <= c48 * 3 + 1;
+    c64 <= c64 * 7 + 1;
+  end
+
+  initial begin
+    count = 0;
+    level = 0.0;
+`ifdef BUILTIN_DUMP
+    $dumpfile("builtin.vcd");
+    $dumpvars(1, top);
+`else
+    $fast_dumpvars(top, "fast.vcd");
+`endif
+    repeat (`STEPS) begin
+      #1 clk = 1;
+      #1 clk = 0;
+    end
+    $finish;
+  end
+
+endmodule : top
@@ -0,0 +1,326 @@
+import std/[memfiles, os, strformat, times]
+import svvpi
+import ../def_layout
+import name_tree
+
+## Binary index of the design's module hierarchy.
+##
+## Walking the live design through VPI is slow on big designs, and
+## every run of a simulation walks the same design again.  Instead,
+## the first run writes what the walk found to an index file, named
+## after a fingerprint of the design, and later runs of the same design
+## map that file read-only rather than walking.  Since the file is
+## mapped and never written to, simultaneous simulations of the same
+## design on one host share its pages.
+##
+## The file consists of:
+##
+##   header     a `HierHeader`
+##   instances  one `HierInstance` per module instance, in depth-first
+##              pre-order, so that the subtree of instance i is the
+##              range i ..< subtreeEnd, and its children are found by
+##              hopping from one subtreeEnd to the next; the signals of
+##              the generate scopes in an instance are counted as its
+##              own, and the instances in them are its children, named
+##              by their path from it (g[1].u_bank)
+##   pool       the instance and definition names, each stored once,
+##              back to back
+##
+## all in the host's byte order.  The file is written to a temporary
+## name and then renamed, so that no simulation ever sees a partly
+## written index.
+##
+## The fingerprint covers the simulator's product and version, its
+## command line, the size and modification time of every file named on
+## the command line, and the top-level modules.  Anything else that
+## changes the design without changing these (e.g. a new snapshot built
+## from sources included by another file) needs +hier_index_rebuild.
+
+const
+  hierMagic* = "VPIHIX01"
+  hierVersion* = 2
+
+type
+  HierHeader* = object
+    magic*: array[8, char]
+    version*: int32
+    nInstances*: int32
+    fingerprint*: uint64
+    instancesOffset*: int64
+    poolOffset*: int64
+    poolLen*: int64
+
+  HierInstance* = object
+    parent*: int32       ## index of the parent instance, -1 for top-level modules
+    subtreeEnd*: int32   ## one past the index of the last instance in the subtree
+    depth*: int32        ## 0 for top-level modules
+    nameOffset*: uint32  ## vpiName, in the pool
+    nameLen*: uint32
+    defOffset*: uint32   ## vpiDefName, in the pool
+    defLen*: uint32
+    nNets*: uint32       ## nets found directly in the instance, or its generate scopes
+    nVariables*: uint32  ## variables found directly in the instance, or its generate scopes
+    pad: uint32
+    netBits*: uint64     ## total width of those nets
+    variableBits*: uint64  ## total width of those variables
+
+  HierIndex* = object
+    file: MemFile
+    header: ptr HierHeader
+    instances*: ptr UncheckedArray[HierInstance]
+    pool: ptr UncheckedArray[char]
+    len*: int            ## number of instances
+
+  IndexBuilder = object
+    instances: seq[HierInstance]
+    names: NameTree                  ## only as a pool of interned instance and definition names
+
+proc fnv1a(h: var uint64; data: openArray[char]) =
+  ## Mix `data` into the FNV-1a hash `h`.
+  for c in data:
+    h = (h xor c.uint64) * 0x100000001b3'u64
+
+proc designFingerprint*(): uint64 =
+  ## Fingerprint of the design being simulated, cheap to compute: see
+  ## the module documentation for what it covers.
+  result = 0xcbf29ce484222325'u64
+  var
+    info: s_vpi_vlog_info
+  if vpi_get_vlog_info(addr info) != 0:
+    result.fnv1a($info.product)
+    result.fnv1a($info.version)
+    let
+      argv = cast[cstringArray](info.argv)
+    for i in 0 ..< info.argc.int:
+      let
+        arg = $argv[i]
+      result.fnv1a(arg)
+      result.fnv1a("\0")
+      if arg.len > 0 and arg[0] notin {'-', '+'} and fileExists(arg):
+        let
+          fi = getFileInfo(arg)
+        result.fnv1a(&"{fi.size}:{fi.lastWriteTime.toUnix}")
+  for top, _ in vpiHandles2(nil, vpiModule):
+    result.fnv1a($vpi_get_str(vpiDefName, top))
+    result.fnv1a("\0")
+
+proc addCounts(inst: var HierInstance; layout: DefLayout) =
+  ## Add the signals of `layout` to the counts of `inst`.
+  inst.nNets += layout.nNets.uint32
+  inst.nVariables += uint32(layout.len - layout.nNets)
+  inst.netBits += layout.netBits.uint64
+  inst.variableBits += layout.variableBits.uint64
+
+proc addInstance(b: var IndexBuilder; modHandle: VpiHandle; prefix: string; parent, depth: int)
+
+proc addBelow(b: var IndexBuilder; scope: VpiHandle; prefix: string; index, depth: int) =
+  ## Add what is found in `scope`, instance `index` or a generate scope
+  ## in it: the module instances, below instance `index`, and the
+  ## signals of the generate scopes, to the counts of instance `index`,
+  ## recursively.  `prefix` is the path from instance `index` to `scope`.
+  for subModHandle, _ in scope.vpiHandles2(vpiModule):
+    b.addInstance(subModHandle, prefix, index, depth + 1)
+  for child, _ in scope.vpiHandles2(vpiInternalScope):
+    if vpi_get(vpiType, child) == vpiGenScope:
+      b.instances[index].addCounts(getLayout(child))
+      b.addBelow(child, prefix & $vpi_get_str(vpiName, child) & ".", index, depth)
+
+proc addInstance(b: var IndexBuilder; modHandle: VpiHandle; prefix: string; parent, depth: int) =
+  ## Add `modHandle` and, recursively, the module instances below it.
+  ## An instance inside generate scopes is named by its path from its
+  ## parent instance (e.g. "g[1].u_bank"), `prefix` being that path up
+  ## to the instance.
+  let
+    path = prefix & $vpi_get_str(vpiName, modHandle)
+    name = b.names.intern(path.cstring)
+    defName = b.names.intern(vpi_get_str(vpiDefName, modHandle))
+    index = b.instances.len
+  var
+    inst = HierInstance(parent: parent.int32,
+                        depth: depth.int32,
+                        nameOffset: b.names.atomOffset(name).uint32,
+                        nameLen: b.names.atomLen(name).uint32,
+                        defOffset: b.names.atomOffset(defName).uint32,
+                        defLen: b.names.atomLen(defName).uint32)
+  # The signal counts are the same for all instances of a definition.
+  inst.addCounts(getLayout(modHandle))
+  b.instances.add(inst)
+  b.addBelow(modHandle, "", index, depth)
+  b.instances[index].subtreeEnd = b.instances.len.int32
+
+proc writeHierIndex*(path: string; fingerprint: uint64): bool =
+  ## Walk the live design, and write its index to `path`.  Returns
+  ## false if the file could not be written.
+  var
+    b: IndexBuilder
+  for top, _ in vpiHandles2(nil, vpiModule):
+    b.addInstance(top, "", -1, 0)
+
+  var
+    header = HierHeader(version: hierVersion,
+                        nInstances: b.instances.len.int32,
+                        fingerprint: fingerprint,
+                        instancesOffset: sizeof(HierHeader),
+                        poolLen: b.names.poolSize)
+  for j, c in hierMagic:
+    header.magic[j] = c
+  header.poolOffset = header.instancesOffset + b.instances.len * sizeof(HierInstance)
+
+  let
+    tmpPath = &"{path}.{getCurrentProcessId()}.tmp"
+  var
+    f: File
+  if not open(f, tmpPath, fmWrite):
+    return false
+  discard f.writeBuffer(addr header, sizeof(HierHeader))
+  if b.instances.len > 0:
+    discard f.writeBuffer(addr b.instances[0], b.instances.len * sizeof(HierInstance))
+  f.write(b.names.pool)
+  f.close()
+  try:
+    moveFile(tmpPath, path)
+  except OSError:
+    discard tryRemoveFile(tmpPath)
+    return false
+  return true
+
+proc openHierIndex*(idx: var HierIndex; path: string; fingerprint: uint64): bool =
+  ## Map the index file `path` read-only.  Returns false if there is no
+  ## such file, or if it is not an index of the design `fingerprint`.
+  try:
+    idx.file = memfiles.open(path, mode = fmRead)
+  except OSError, IOError:
+    return false
+  if idx.file.size < sizeof(HierHeader):
+    idx.file.close()
+    return false
+  let
+    data = cast[ptr UncheckedArray[byte]](idx.file.mem)
+  idx.header = cast[ptr HierHeader](data)
+  var
+    ok = idx.header.version == hierVersion and idx.header.fingerprint == fingerprint and
+         idx.header.poolOffset + idx.header.poolLen <= idx.file.size
+  for j, c in hierMagic:
+    ok = ok and idx.header.magic[j] == c
+  if not ok:
+    idx.file.close()
+    return false
+  idx.instances = cast[ptr UncheckedArray[HierInstance]](addr data[idx.header.instancesOffset.int])
+  idx.pool = cast[ptr UncheckedArray[char]](addr data[idx.header.poolOffset.int])
+  idx.len = idx.header.nInstances.int
+  return true
+
+proc loadHierIndex*(idx: var HierIndex; dir = ".hier_index"; rebuild = false): bool =
+  ## Map the index of the design being simulated from `dir`, writing it
+  ## there first if it does not exist yet (or if `rebuild` is set).
+  ## Returns false if the index could neither be read nor written.
+  let
+    fingerprint = designFingerprint()
+    path = dir / &"{fingerprint:016x}.hix"
+  if not rebuild and idx.openHierIndex(path, fingerprint):
+    return true
+  try:
+    createDir(dir)
+  except OSError:
+    return false
+  return writeHierIndex(path, fingerprint) and idx.openHierIndex(path, fingerprint)
+
+proc close*(idx: var HierIndex) =
+  ## Unmap the index.
+  idx.file.close()
+  idx.instances = nil
+  idx.len = 0
+
+proc name*(idx: HierIndex; i: int): string =
+  ## vpiName of instance `i`.
+  let
+    inst = idx.instances[i]
+  result = newString(inst.nameLen.int)
+  if inst.nameLen > 0:
+    copyMem(addr result[0], addr idx.pool[inst.nameOffset.int], inst.nameLen.int)
+
+proc addName*(buf: var string; idx: HierIndex; i: int) =
+  ## Append the vpiName of instance `i`, straight from the pool.
+  let
+    inst = idx.instances[i]
+    start = buf.len
+  buf.setLen(start + inst.nameLen.int)
+  if inst.nameLen > 0:
+    copyMem(addr buf[start], addr idx.pool[inst.nameOffset.int], inst.nameLen.int)
+
+proc defName*(idx: HierIndex; i: int): string =
+  ## vpiDefName of instance `i`.
+  let
+    inst = idx.instances[i]
+  result = newString(inst.defLen.int)
+  if inst.defLen > 0:
+    copyMem(addr result[0], addr idx.pool[inst.defOffset.int], inst.defLen.int)
+
+proc nameIs(idx: HierIndex; i: int; name: openArray[char]): bool =
+  let
+    inst = idx.instances[i]
+  if inst.nameLen.int != name.len:
+    return false
+  for j in 0 ..< name.len:
+    if idx.pool[inst.nameOffset.int + j] != name[j]:
+      return false
+  return true
+
+proc fullName*(idx: HierIndex; i: int; buf: var string) =
+  ## Put the full hierarchical name of instance `i` in `buf`, filling it
+  ## in from the end as name_tree.nim does.
+  var
+    fullLen = -1
+    n = i
+  while n >= 0:
+    fullLen += idx.instances[n].nameLen.int + 1
+    n = idx.instances[n].parent
+  buf.setLen(fullLen)
+  n = i
+  var
+    pos = fullLen
+  while n >= 0:
+    let
+      inst = idx.instances[n]
+    pos -= inst.nameLen.int
+    if inst.nameLen > 0:
+      copyMem(addr buf[pos], addr idx.pool[inst.nameOffset.int], inst.nameLen.int)
+    n = inst.parent
+    if n >= 0:
+      dec pos
+      buf[pos] = '.'
+
+iterator children*(idx: HierIndex; i: int): int =
+  ## Indices of the instances directly below instance `i`, or of the
+  ## top-level modules if `i` is -1.
+  var
+    j = i + 1
+    last = if i < 0: idx.len else: idx.instances[i].subtreeEnd.int
+  while j < last:
+    yield j
+    j = idx.instances[j].subtreeEnd.int
+
+proc find*(idx: HierIndex; path: string): int =
+  ## Index of the instance with the full name `path`, or -1.  Only the
+  ## children of the instances along the path are looked at.  The name
+  ## of a child can take more than one level of the path (generate
+  ## scopes), so each child's name is compared with the start of what
+  ## is left of the path.
+  var
+    parent = -1
+    start = 0
+  while start < path.len:
+    var
+      found = -1
+    for child in idx.children(parent):
+      let
+        stop = start + idx.instances[child].nameLen.int
+      if stop <= path.len and (stop == path.len or path[stop] == '.') and
+         idx.nameIs(child, path.toOpenArray(start, stop - 1)):
+        found = child
+        break
+    if found < 0:
+      return -1
+    parent = found
+    start += idx.instances[parent].nameLen.int + 1
+  return parent
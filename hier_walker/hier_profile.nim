@@ -0,0 +1,163 @@
+import std/[algorithm, json, strformat, tables]
+import svvpi
+import ../def_layout
+import name_tree
+
+## Sizes of the design, to know what a dump or a set of probes would
+## cost before turning them on.
+##
+## One walk of the module hierarchy counts, for every instance and
+## for the subtree below it, the instances, nets, variables, total
+## bits, and words of arrays and memories.  The signals of the
+## generate scopes in an instance count as the instance's own, and the
+## module instances in them as its children.  The subtree counts are
+## added up on the way back from each child, so no instance is visited
+## twice.  The counts of an instance itself come from the layout of its
+## definition (see ../def_layout.nim), so that the signals of a
+## definition are looked at once, however many instances it has.
+##
+## The counts are also added up per definition (by vpiDefName), for a
+## list of the definitions that weigh the most bits across all of their
+## instances.
+
+type
+  ProfileCounts* = object
+    instances*: int
+    nets*: int           ## net arrays included
+    variables*: int
+    bits*: int
+    words*: int          ## words of arrays and memories
+
+  ProfileInstance* = object
+    node*: int           ## in `names`
+    defName*: string
+    depth*: int
+    own*: ProfileCounts  ## of the instance itself
+    total*: ProfileCounts  ## of its subtree, the instance included
+
+  DefProfile* = object
+    defName*: string
+    counts*: ProfileCounts  ## over all the instances of the definition
+
+  HierProfile* = object
+    names*: NameTree
+    instances*: seq[ProfileInstance]  ## in depth-first pre-order
+    design*: ProfileCounts
+    defs*: seq[DefProfile]
+
+proc add(a: var ProfileCounts; b: ProfileCounts) =
+  a.instances += b.instances
+  a.nets += b.nets
+  a.variables += b.variables
+  a.bits += b.bits
+  a.words += b.words
+
+proc layoutCounts(layout: DefLayout): ProfileCounts =
+  ## Counts of the signals of a layout.
+  return ProfileCounts(nets: layout.nNets + layout.nNetArrays,
+                       variables: layout.len - layout.nNets,
+                       bits: layout.netBits + layout.variableBits,
+                       words: layout.arrayWords)
+
+proc addInstance(p: var HierProfile; defIndex: var Table[string, int];
+                 modHandle: VpiHandle; parent, depth: int): ProfileCounts
+
+proc addBelow(p: var HierProfile; defIndex: var Table[string, int];
+              scope: VpiHandle; node, depth: int; own, total: var ProfileCounts) =
+  ## Add what is found in `scope`, a module instance or a generate scope
+  ## in it: the module instances to the subtree, and the signals of the
+  ## generate scopes to the instance itself, recursively.  `node` is
+  ## the name of `scope`, and `depth` the depth of its instance.
+  for subModHandle, _ in scope.vpiHandles2(vpiModule):
+    total.add(p.addInstance(defIndex, subModHandle, node, depth + 1))
+  for child, _ in scope.vpiHandles2(vpiInternalScope):
+    if vpi_get(vpiType, child) == vpiGenScope:
+      let
+        counts = layoutCounts(getLayout(child))
+        childNode = p.names.addNode(node, vpi_get_str(vpiName, child))
+      own.add(counts)
+      total.add(counts)
+      p.addBelow(defIndex, child, childNode, depth, own, total)
+
+proc addInstance(p: var HierProfile; defIndex: var Table[string, int];
+                 modHandle: VpiHandle; parent, depth: int): ProfileCounts =
+  ## Count `modHandle` and, recursively, the module instances below it.
+  ## `parent` is the name of the scope it is in.  Returns the counts of
+  ## its subtree.
+  let
+    layout = getLayout(modHandle)
+    index = p.instances.len
+  var
+    own = layoutCounts(layout)
+  own.instances = 1
+  # The instances profiled from are named in full.
+  p.instances.add(ProfileInstance(node: p.names.addNode(parent, vpi_get_str(if parent < 0: vpiFullName else: vpiName, modHandle)),
+                                  defName: layout.defName,
+                                  depth: depth))
+  result = own
+  p.addBelow(defIndex, modHandle, p.instances[index].node, depth, own, result)
+  p.instances[index].own = own
+  p.instances[index].total = result
+
+  let
+    d = defIndex.mgetOrPut(layout.defName, p.defs.len)
+  if d == p.defs.len:
+    p.defs.add(DefProfile(defName: layout.defName))
+  p.defs[d].counts.add(own)
+
+proc profileHierarchy*(tops: openArray[VpiHandle]): HierProfile =
+  ## Profile the subtrees of `tops`, or of the top-level modules if
+  ## `tops` is empty.
+  var
+    defIndex: Table[string, int]
+  if tops.len == 0:
+    for top, _ in vpiHandles2(nil, vpiModule):
+      result.design.add(result.addInstance(defIndex, top, -1, 0))
+  else:
+    for top in tops:
+      result.design.add(result.addInstance(defIndex, top, -1, 0))
+  result.defs.sort(proc (a, b: DefProfile): int = cmp(b.counts.bits, a.counts.bits))
+
+proc toJson(c: ProfileCounts): JsonNode =
+  return %*{"instances": c.instances, "nets": c.nets, "variables": c.variables,
+            "bits": c.bits, "words": c.words}
+
+proc writeReport*(p: HierProfile; path: string; topK: int; maxDepth = high(int)): bool =
+  ## Write the profile to `path` as JSON: the counts of the whole
+  ## design, of the `topK` heaviest definitions, and of the subtree of
+  ## every instance down to `maxDepth` levels below the top.  Returns
+  ## false if the file could not be written.
+  var
+    f: File
+  if not open(f, path, fmWrite):
+    return false
+  f.write("{\n  \"design\": ")
+  f.write($p.design.toJson)
+  f.write(",\n  \"top_definitions\": [")
+  for i in 0 ..< min(topK, p.defs.len):
+    var
+      node = p.defs[i].counts.toJson
+    node["def"] = %p.defs[i].defName
+    f.write(if i == 0: "\n    " else: ",\n    ")
+    f.write($node)
+  f.write("\n  ],\n  \"subtrees\": [")
+  # One line per instance, written as it goes, so that a big design
+  # does not need its whole report in memory.
+  var
+    name, line: string
+    first = true
+  for inst in p.instances:
+    if inst.depth > maxDepth:
+      continue
+    p.names.fullName(inst.node, name)
+    line.setLen(0)
+    line.add(if first: "\n    {\"path\": " else: ",\n    {\"path\": ")
+    escapeJson(name, line)
+    line.add(", \"def\": ")
+    escapeJson(inst.defName, line)
+    line.add(&", \"depth\": {inst.depth}, \"self\": {inst.own.toJson}, \"total\": {inst.total.toJson}}}")
+    f.write(line)
+    first = false
+  f.write("\n  ]\n}\n")
+  f.close()
+  return true
@@ -0,0 +1,375 @@
+import std/[strformat, strutils, tables]
+import svvpi
+import ../def_layout
+import name_tree
+
+## Filtered queries on the live design's hierarchy.
+##
+## A query is a string of key=value terms, separated by spaces:
+##
+##   kind=instance|net|variable|signal   what to look for (default instance;
+##                                       signal is nets and variables)
+##   under=<path glob>      only below (and at) the scopes matching it
+##   def=<glob>             instances of matching definitions only
+##   name=<glob>            objects with a matching local name only
+##   minwidth=<n>           signals at least n bits wide only
+##   maxwidth=<n>           signals at most n bits wide only
+##   depth=<n>              do not go more than n levels below the top
+##   generate=1             report generate scopes as instances too
+##   interfaces=1           look at interface instances too
+##   first=<n>              stop after n results
+##
+## e.g. "kind=net under=top.soc.cpu* name=*_valid minwidth=65 depth=6".
+##
+## A glob is matched against a whole name: "*" matches any run of
+## characters and "?" any one character.  A path glob is a glob per
+## level of the hierarchy, separated by dots; its "*" stays within one
+## level, and a level "**" matches any number of levels.  Brackets are
+## plain characters, so "g[3]" matches the generate block g[3].
+##
+## The globs are compiled once per query.  The path glob is run as a
+## small automaton down the hierarchy, so a subtree is pruned as soon
+## as no path below it can match.  The scopes and signals found are
+## kept, with their names interned in a name tree (see name_tree.nim),
+## so that later queries do not go back to VPI for them, and the hits
+## of each query are kept so that repeating it costs nothing.
+
+type
+  Glob* = object
+    pieces: seq[string]  ## the literal parts between the stars
+    starAtStart, starAtEnd: bool
+
+  PathGlob* = object
+    levels: seq[Glob]
+    anyLevels: seq[bool]  ## true for the "**" levels
+
+  QueryKind* = enum
+    qkInstance, qkNet, qkVariable
+
+  HierQuery* = object
+    kinds*: set[QueryKind]
+    under*: PathGlob
+    def*, name*: Glob
+    minWidth*, maxWidth*: int
+    maxDepth*: int
+    generate*, interfaces*: bool
+    first*: int  ## 0 for no limit
+
+  QueryHit* = object
+    handle*: VpiHandle
+    node*: int      ## in `names`, for `hitName`
+    width*: int     ## for signals, 0 for instances
+
+  ScopeKind = enum
+    skModule, skInterface, skGenerate
+
+  SignalEntry = object
+    handle: VpiHandle
+    node: int
+    kind: QueryKind
+    width: int
+
+  ScopeNode = object
+    handle: VpiHandle
+    node: int                   ## in `names`
+    kind: ScopeKind
+    def: int32                  ## atom of vpiDefName, -1 for generate scopes
+    children: seq[int32]        ## indices in `scopes`
+    expanded: bool
+    signals: seq[SignalEntry]
+    signalsFound: bool
+
+var
+  names*: NameTree              ## names of all the scopes and signals seen so far
+  scopes: seq[ScopeNode]
+  tops: seq[int32]
+  topsFound: bool
+  cache: Table[string, seq[QueryHit]]
+
+proc compileGlob*(pattern: string): Glob =
+  ## Compile a glob; "" and "*" match everything.
+  result.starAtStart = pattern.len == 0 or pattern[0] == '*'
+  result.starAtEnd = pattern.len == 0 or pattern[^1] == '*'
+  for piece in pattern.split('*'):
+    if piece.len > 0:
+      result.pieces.add(piece)
+
+proc pieceAt(piece: string; s: openArray[char]; pos: int): bool =
+  if pos < 0 or pos + piece.len > s.len:
+    return false
+  for i, c in piece:
+    if c != '?' and c != s[pos + i]:
+      return false
+  return true
+
+proc match*(g: Glob; s: openArray[char]): bool =
+  ## True if the glob matches all of `s`.
+  if g.pieces.len == 0:
+    return g.starAtStart or s.len == 0
+  var
+    pos = 0
+    limit = s.len  # the pieces in between must end by here
+    first = 0
+    last = g.pieces.len - 1
+  if not g.starAtStart:
+    if not g.pieces[0].pieceAt(s, 0):
+      return false
+    pos = g.pieces[0].len
+    first = 1
+  if not g.starAtEnd:
+    if last < first:
+      # A single piece, anchored at both ends.
+      return pos == s.len
+    if not g.pieces[last].pieceAt(s, s.len - g.pieces[last].len) or
+       s.len - g.pieces[last].len < pos:
+      return false
+    limit = s.len - g.pieces[last].len
+    dec last
+  # The pieces in between, each as far left as possible.
+  for i in first .. last:
+    var
+      found = false
+    while pos + g.pieces[i].len <= limit:
+      if g.pieces[i].pieceAt(s, pos):
+        found = true
+        break
+      inc pos
+    if not found:
+      return false
+    pos += g.pieces[i].len
+  return true
+
+proc matchAll(g: Glob): bool {.inline.} =
+  return g.pieces.len == 0 and g.starAtStart
+
+proc compilePathGlob*(pattern: string): PathGlob =
+  ## Compile a path glob, splitting it into levels at the dots outside
+  ## brackets.
+  if pattern.len == 0:
+    return
+  var
+    depth = 0
+    start = 0
+  for i in 0 .. pattern.len:
+    if i == pattern.len or (pattern[i] == '.' and depth == 0):
+      let
+        level = pattern[start ..< i]
+      result.anyLevels.add(level == "**")
+      result.levels.add(compileGlob(level))
+      start = i + 1
+    elif pattern[i] == '[':
+      inc depth
+    elif pattern[i] == ']':
+      dec depth
+
+# The states of the path automaton are the numbers of levels of the
+# path glob matched so far, kept as a bit mask; bit levels.len means
+# that the whole path glob has matched.
+
+proc closure(p: PathGlob; states: uint64): uint64 =
+  ## Add the states reached by skipping "**" levels, which can also
+  ## match no level at all.
+  result = states
+  for i in 0 ..< p.levels.len:
+    if (result and (1'u64 shl i)) != 0 and p.anyLevels[i]:
+      result = result or (1'u64 shl (i + 1))
+
+proc startStates(p: PathGlob): uint64 =
+  return p.closure(1)
+
+proc accepts(p: PathGlob; states: uint64): bool {.inline.} =
+  return (states and (1'u64 shl p.levels.len)) != 0
+
+proc step(p: PathGlob; states: uint64; name: openArray[char]): uint64 =
+  ## The states after going down into a scope called `name`.  Once the
+  ## whole path glob has matched, everything below matches too.
+  if p.accepts(states):
+    return states
+  for i in 0 ..< p.levels.len:
+    if (states and (1'u64 shl i)) != 0:
+      if p.anyLevels[i]:
+        result = result or (1'u64 shl i)
+      elif p.levels[i].match(name):
+        result = result or (1'u64 shl (i + 1))
+  result = p.closure(result)
+
+proc parseQuery*(text: string; q: var HierQuery; err: var string): bool =
+  ## Parse a query, see the module documentation.  On error, sets `err`
+  ## and returns false.
+  q = HierQuery(kinds: {qkInstance}, maxWidth: high(int), maxDepth: high(int))
+  for term in text.splitWhitespace():
+    let
+      eq = term.find('=')
+      key = if eq < 0: term else: term[0 ..< eq]
+      value = if eq < 0: "1" else: term[eq + 1 .. ^1]
+    try:
+      case key
+      of "kind":
+        case value
+        of "instance": q.kinds = {qkInstance}
+        of "net": q.kinds = {qkNet}
+        of "variable": q.kinds = {qkVariable}
+        of "signal": q.kinds = {qkNet, qkVariable}
+        else:
+          err = &"unknown kind {value}"
+          return false
+      of "under": q.under = compilePathGlob(value)
+      of "def": q.def = compileGlob(value)
+      of "name": q.name = compileGlob(value)
+      of "minwidth": q.minWidth = parseInt(value)
+      of "maxwidth": q.maxWidth = parseInt(value)
+      of "depth": q.maxDepth = parseInt(value)
+      of "generate": q.generate = parseInt(value) != 0
+      of "interfaces": q.interfaces = parseInt(value) != 0
+      of "first": q.first = parseInt(value)
+      else:
+        err = &"unknown term {key}"
+        return false
+    except ValueError:
+      err = &"{key} needs a number, not {value}"
+      return false
+  if q.under.levels.len > 63:
+    err = "the under= path has too many levels"
+    return false
+  return true
+
+proc addScope(parent: int; handle: VpiHandle; kind: ScopeKind): int32 =
+  let
+    parentNode = if parent < 0: -1 else: scopes[parent].node
+  result = scopes.len.int32
+  scopes.add(ScopeNode(handle: handle,
+                       node: names.addNode(parentNode, vpi_get_str(vpiName, handle)),
+                       kind: kind,
+                       def: if kind == skGenerate: -1 else: names.intern(vpi_get_str(vpiDefName, handle))))
+
+proc topScopes(): lent seq[int32] =
+  ## The top-level modules, found on first use.
+  if not topsFound:
+    for top, _ in vpiHandles2(nil, vpiModule):
+      tops.add(addScope(-1, top, skModule))
+    topsFound = true
+  return tops
+
+proc expand(s: int) =
+  ## Find the module instances, interface instances and generate scopes
+  ## directly in scope `s`.
+  if scopes[s].expanded:
+    return
+  scopes[s].expanded = true
+  let
+    handle = scopes[s].handle
+  for child, _ in handle.vpiHandles2(vpiModule):
+    let
+      c = addScope(s, child, skModule)
+    scopes[s].children.add(c)
+  for child, _ in handle.vpiHandles2(vpiInterface):
+    let
+      c = addScope(s, child, skInterface)
+    scopes[s].children.add(c)
+  for child, _ in handle.vpiHandles2(vpiInternalScope):
+    if vpi_get(vpiType, child) == vpiGenScope:
+      let
+        c = addScope(s, child, skGenerate)
+      scopes[s].children.add(c)
+
+proc findSignals(s: int) =
+  ## Find the nets and variables directly in scope `s`.  Their names and
+  ## widths come from the layout of the scope's definition.
+  if scopes[s].signalsFound:
+    return
+  scopes[s].signalsFound = true
+  var
+    handles: seq[VpiHandle]
+    buf: string
+  let
+    layout = getLayout(scopes[s].handle, handles)
+  for i, sigHandle in handles:
+    buf.setLen(0)
+    buf.addName(layout, i)
+    let
+      sig = layout.signals[i]
+      entry = SignalEntry(handle: sigHandle,
+                          node: names.addNode(scopes[s].node, buf.cstring),
+                          kind: if sig.kind == skNet: qkNet else: qkVariable,
+                          width: sig.size.int)
+    scopes[s].signals.add(entry)
+
+proc atomMatches(g: Glob; atom: int32; buf: var string): bool =
+  if g.matchAll:
+    return true
+  buf.setLen(0)
+  buf.addAtom(names, atom)
+  return g.match(buf)
+
+proc enough(q: HierQuery; hits: seq[QueryHit]): bool {.inline.} =
+  return q.first > 0 and hits.len >= q.first
+
+proc search(q: HierQuery; s, depth: int; states: uint64; hits: var seq[QueryHit]; buf: var string) =
+  ## Look for hits in scope `s` and below, `states` being the states of
+  ## the path automaton in `s`.
+  let
+    inside = q.under.accepts(states)
+    kind = scopes[s].kind
+  if kind == skInterface and not q.interfaces:
+    return
+  if inside:
+    if qkInstance in q.kinds and (kind != skGenerate or q.generate) and
+       (kind == skGenerate or q.def.atomMatches(scopes[s].def, buf)) and
+       q.name.atomMatches(names.nodes[scopes[s].node].atom, buf):
+      hits.add(QueryHit(handle: scopes[s].handle, node: scopes[s].node))
+      if q.enough(hits):
+        return
+    if (q.kinds * {qkNet, qkVariable}) != {}:
+      findSignals(s)
+      for e in scopes[s].signals:
+        if e.kind in q.kinds and e.width >= q.minWidth and e.width <= q.maxWidth and
+           q.name.atomMatches(names.nodes[e.node].atom, buf):
+          hits.add(QueryHit(handle: e.handle, node: e.node, width: e.width))
+          if q.enough(hits):
+            return
+  if depth >= q.maxDepth:
+    return
+  expand(s)
+  for k in 0 ..< scopes[s].children.len:
+    let
+      c = scopes[s].children[k]
+      next = if inside: states
+             else:
+               buf.setLen(0)
+               buf.addName(names, scopes[c].node)
+               q.under.step(states, buf)
+    if next != 0:
+      search(q, c, depth + 1, next, hits, buf)
+      if q.enough(hits):
+        return
+
+proc runQuery*(text: string; hits: var seq[QueryHit]; err: var string): bool =
+  ## Run the query `text` on the design, and put what it found in
+  ## `hits`.  On a bad query, sets `err` and returns false.
+  if text in cache:
+    hits = cache[text]
+    return true
+  var
+    q: HierQuery
+  if not parseQuery(text, q, err):
+    return false
+  hits.setLen(0)
+  var
+    buf: string
+  let
+    start = q.under.startStates
+  for top in topScopes():
+    buf.setLen(0)
+    buf.addName(names, scopes[top].node)
+    let
+      states = q.under.step(start, buf)
+    if states != 0:
+      search(q, top, 0, states, hits, buf)
+      if q.enough(hits):
+        break
+  cache[text] = hits
+  return true
+
+proc hitName*(hit: QueryHit; buf: var string) =
+  ## Put the full name of what was found in `buf`.
+  names.fullName(hit.node, buf)
@@ -1,18 +1,143 @@
-import std/[strformat, strutils, sugar]
+import std/[strformat, strutils]
 import svvpi
+import ../common, ../output_sink
+import hier_index, hier_profile, hier_query
+
+## The hierarchy is read from the index of hier_index.nim, which is
+## written by the first run of a design, and only mapped by later
+## runs.  Plusargs:
+##   +hier_index_dir=<dir>  where the index files are kept (default .hier_index)
+##   +hier_index_rebuild    walk the live design and rewrite the index
+##   +hier_index_off        walk the live design, without any index
+##
+## $profile_hierarchy takes the plusargs:
+##   +hier_profile_top=<k>    number of heaviest definitions reported (default 10)
+##   +hier_profile_depth=<n>  subtrees reported down to n levels below the top
+##                            (default all of them)
 
 vpiDefine task walk_hierarchy:
-  ## Goes through the entire design's hierarchy, and prints the full
-  ## names of all of the module instances.
+  ## Goes through the entire design's hierarchy, and prints the local
+  ## name of each module instance, indented by its depth.
+  calltf:
+    # Each line is rendered into one buffer, reused from one instance
+    # to the next: on the live walk from the name the simulator gives,
+    # and from the index straight from its pool of names.
+    var
+      line: string
+    proc indent(level: int) =
+      line.setLen(2 * level)
+      for i in 0 ..< line.len:
+        line[i] = ' '
+    # As in the index, an instance inside generate scopes is named by
+    # its path from its parent instance (e.g. "g[1].u_bank"), `prefix`
+    # being that path up to the instance.
+    proc recursiveWalk(scope: VpiHandle = nil; prefix = ""; level = 0) =
+      for subModHandle, subModIter in scope.vpiHandles2(vpiModule):
+        indent(level)
+        line.add(prefix)
+        line.add(vpi_get_str(vpiName, subModHandle))
+        echoLine line
+        recursiveWalk(subModHandle, "", level + 1)
+      if scope != nil:
+        for child, _ in scope.vpiHandles2(vpiInternalScope):
+          if vpi_get(vpiType, child) == vpiGenScope:
+            recursiveWalk(child, prefix & $vpi_get_str(vpiName, child) & ".", level)
+
+    var
+      idx: HierIndex
+    let
+      dir = plusarg("hier_index_dir")
+    if hasPlusarg("hier_index_off") or
+       not idx.loadHierIndex(if dir.len > 0: dir else: ".hier_index", rebuild = hasPlusarg("hier_index_rebuild")):
+      recursiveWalk()
+    else:
+      for i in 0 ..< idx.len:
+        indent(idx.instances[i].depth)
+        line.addName(idx, i)
+        echoLine line
+      idx.close()
+    flushOutput()
+
+vpiDefine task query_hierarchy:
+  ## Prints the full names of what the query string in its argument
+  ## finds in the hierarchy; see hier_query.nim for the query terms.
+  compiletf:
+    systfHandle.vpiNumArgCheck(1)
+
   calltf:
-    proc recursiveWalk(modHandle: VpiHandle = nil; level = 0; parentModPath = "") =
-      for subModHandle, subModIter in modHandle.vpiHandles2(vpiModule):
-        let
-          indent = "  ".repeat(level)
-          modPath = $vpi_get_str(vpiFullName, subModHandle)
-          pathWithoutParent = modPath.dup(removePrefix(parentModPath & "."))
-        vpiEcho &"{indent}{pathWithoutParent}"
-        recursiveWalk(subModHandle, level + 1, modPath)
-    recursiveWalk()
-
-setVlogStartupRoutines(walk_hierarchy)
+    var
+      queryArg: VpiHandle
+    for _, argHandle in systfHandle.vpiArgs:
+      queryArg = argHandle
+    var
+      query = s_vpi_value(format: vpiStringVal)
+    vpi_get_value(queryArg, addr query)
+    var
+      hits: seq[QueryHit]
+      err: string
+      line: string
+    let
+      text = $query.value.str
+    if not runQuery(text, hits, err):
+      vpiEcho &"*E,QUERY_HIERARCHY: {err}"
+      return
+    echoLine &"{hits.len} hits for \"{text}\""
+    for hit in hits:
+      hitName(hit, line)
+      if hit.width > 0:
+        line.add(&" [{hit.width}]")
+      echoLine line
+    flushOutput()
+
+vpiDefine task profile_hierarchy:
+  ## Counts the instances, nets, variables, bits and array words of the
+  ## design, or of the module instances given as arguments, per
+  ## subtree and per definition, and writes them to a JSON report.  A
+  ## string argument names the report (default hier_profile.json).
+  compiletf:
+    for argIndex, argHandle in systfHandle.vpiArgs:
+      let
+        argType = vpi_get(vpiType, argHandle)
+      if argType notin {vpiModule, vpiConstant, vpiParameter, vpiReg, vpiStringVar}:
+        vpiException &"Arg {argIndex} must be a module instance or a file name, but its type was {argType}"
+
+  calltf:
+    var
+      tops: seq[VpiHandle]
+      reportPath = "hier_profile.json"
+    for _, argHandle in systfHandle.vpiArgs:
+      if vpi_get(vpiType, argHandle) == vpiModule:
+        tops.add(argHandle)
+      else:
+        var
+          fileName = s_vpi_value(format: vpiStringVal)
+        vpi_get_value(argHandle, addr fileName)
+        reportPath = $fileName.value.str
+    var
+      topK = 10
+      maxDepth = high(int)
+    try:
+      if plusarg("hier_profile_top").len > 0:
+        topK = parseInt(plusarg("hier_profile_top"))
+      if plusarg("hier_profile_depth").len > 0:
+        maxDepth = parseInt(plusarg("hier_profile_depth"))
+    except ValueError:
+      vpiEcho "*E,PROFILE_HIERARCHY: +hier_profile_top and +hier_profile_depth need a number"
+      return
+
+    let
+      profile = profileHierarchy(tops)
+      d = profile.design
+    echoLine &"Design size: {d.instances} instances, {d.nets} nets, {d.variables} variables, {d.bits} bits, {d.words} array words"
+    for i in 0 ..< min(topK, profile.defs.len):
+      let
+        c = profile.defs[i].counts
+      echoLine &"  {profile.defs[i].defName:<20} {c.instances:>8} instances {c.bits:>12} bits {c.words:>10} words"
+    if not profile.writeReport(reportPath, topK, maxDepth):
+      vpiEcho &"*E,PROFILE_HIERARCHY: could not write {reportPath}"
+    else:
+      echoLine &"Profile written to {reportPath}"
+    flushOutput()
+
+
+setVlogStartupRoutines(walk_hierarchy, query_hierarchy, profile_hierarchy)
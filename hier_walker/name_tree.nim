@@ -0,0 +1,140 @@
+## Interned, parent-linked tree of hierarchical names.
+##
+## Each node of the tree stores only the id of its local name (vpiName)
+## and the index of its parent node.  The local names are interned:
+## each distinct name is stored once, in one pool, however many
+## instances share it (u_fifo, gen[0], ..).  Full names are never
+## stored; `fullName` builds one on demand, into a buffer provided by
+## the caller.
+##
+## Interning takes the cstring returned by vpi_get_str as it is, and
+## looks it up in an open-addressing hash table of ids into the pool,
+## so adding a node allocates nothing but the room for new names.
+
+type
+  Atom = object
+    offset: uint32  ## in the pool
+    len: uint32
+
+  NameNode* = object
+    parent*: int32  ## index of the parent node, -1 for top-level nodes
+    atom*: int32    ## id of the local name
+
+  NameTree* = object
+    nodes*: seq[NameNode]
+    atoms: seq[Atom]
+    names: string      ## the distinct local names, back to back
+    slots: seq[int32]  ## atom id + 1 per slot of the hash table, 0 for free
+
+proc hashBytes(p: ptr UncheckedArray[char]; n: int): uint32 =
+  ## FNV-1a hash of `n` bytes at `p`.
+  result = 2166136261'u32
+  for i in 0 ..< n:
+    result = (result xor p[i].uint32) * 16777619'u32
+
+proc atomIs(t: NameTree; id: int32; p: ptr UncheckedArray[char]; n: int): bool =
+  let
+    a = t.atoms[id]
+  return a.len.int == n and (n == 0 or equalMem(unsafeAddr t.names[a.offset.int], p, n))
+
+proc grow(t: var NameTree) =
+  ## Double the hash table, and put the atoms back in.
+  var
+    slots = newSeq[int32](max(1024, 2 * t.slots.len))
+  let
+    mask = slots.len - 1
+  for id, a in t.atoms:
+    var
+      h = hashBytes(cast[ptr UncheckedArray[char]](unsafeAddr t.names[a.offset.int]), a.len.int).int and mask
+    while slots[h] != 0:
+      h = (h + 1) and mask
+    slots[h] = id.int32 + 1
+  t.slots = move(slots)
+
+proc intern*(t: var NameTree; name: cstring): int32 =
+  ## Id of the local name `name`, adding it to the pool if it is new.
+  if 2 * (t.atoms.len + 1) > t.slots.len:
+    t.grow()
+  let
+    nameLen = name.len
+    p = cast[ptr UncheckedArray[char]](name)
+    mask = t.slots.len - 1
+  var
+    h = hashBytes(p, nameLen).int and mask
+  while t.slots[h] != 0:
+    let
+      id = t.slots[h] - 1
+    if t.atomIs(id, p, nameLen):
+      return id
+    h = (h + 1) and mask
+  result = t.atoms.len.int32
+  t.atoms.add(Atom(offset: t.names.len.uint32, len: nameLen.uint32))
+  t.names.add(name)
+  t.slots[h] = result + 1
+
+proc addNode*(t: var NameTree; parent: int; name: cstring): int =
+  ## Add a node named `name` below node `parent` (-1 for a top-level
+  ## node), and return its index.
+  result = t.nodes.len
+  t.nodes.add(NameNode(parent: parent.int32, atom: t.intern(name)))
+
+proc len*(t: NameTree): int {.inline.} =
+  ## Number of nodes.
+  return t.nodes.len
+
+proc atomCount*(t: NameTree): int {.inline.} =
+  ## Number of distinct local names.
+  return t.atoms.len
+
+proc poolSize*(t: NameTree): int {.inline.} =
+  ## Bytes taken by the distinct local names.
+  return t.names.len
+
+proc addAtom*(buf: var string; t: NameTree; id: int32) =
+  ## Append the local name with id `id`.
+  let
+    a = t.atoms[id]
+    start = buf.len
+  buf.setLen(start + a.len.int)
+  if a.len > 0:
+    copyMem(addr buf[start], unsafeAddr t.names[a.offset.int], a.len.int)
+
+proc addName*(buf: var string; t: NameTree; node: int) =
+  ## Append the local name of `node`.
+  buf.addAtom(t, t.nodes[node].atom)
+
+proc fullName*(t: NameTree; node: int; buf: var string) =
+  ## Put the full hierarchical name of `node` in `buf`: its length is
+  ## worked out first, then the names are filled in from the end.
+  var
+    fullLen = -1
+    n = node
+  while n >= 0:
+    fullLen += t.atoms[t.nodes[n].atom].len.int + 1
+    n = t.nodes[n].parent
+  buf.setLen(fullLen)
+  n = node
+  var
+    pos = fullLen
+  while n >= 0:
+    let
+      a = t.atoms[t.nodes[n].atom]
+    pos -= a.len.int
+    if a.len > 0:
+      copyMem(addr buf[pos], unsafeAddr t.names[a.offset.int], a.len.int)
+    n = t.nodes[n].parent
+    if n >= 0:
+      dec pos
+      buf[pos] = '.'
+
+proc atomOffset*(t: NameTree; id: int32): int {.inline.} =
+  ## Offset of the local name `id` in `pool`.
+  return t.atoms[id].offset.int
+
+proc atomLen*(t: NameTree; id: int32): int {.inline.} =
+  ## Length of the local name `id`.
+  return t.atoms[id].len.int
+
+proc pool*(t: NameTree): lent string {.inline.} =
+  ## All the distinct local names, back to back.
+  return t.names
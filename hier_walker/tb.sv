@@ -9,6 +9,12 @@ module top;
 
   initial begin
     $walk_hierarchy;
+    $query_hierarchy("kind=instance def=test*");
+    $query_hierarchy("kind=signal under=top2.** name=*ar");
+    $query_hierarchy("kind=instance under=top.u_top_test3 first=1");
+    $query_hierarchy("kind=instance name=u_bank");
+    $profile_hierarchy;
+    $profile_hierarchy(top2, "top2_profile.json");
     $finish;
   end
 
@@ -34,6 +40,10 @@ endmodule : test2
 module test3;
   test u_test3_test();
   test2 u_test3_test2();
+
+  for (genvar g = 0; g < 2; g++) begin : g_bank
+    test2 u_bank();
+  end
 endmodule : test3
 
 module test4;
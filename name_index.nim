@@ -0,0 +1,132 @@
+import std/[strformat, strutils, tables]
+import svvpi
+
+## Index from hierarchical full names to VPI handles.
+##
+## vpi_handle_by_name is slow on big designs, and probing code calls
+## it over and over with names that share most of their path.  This
+## index is filled in lazily: a lookup that misses expands the scopes
+## along the name's path, from the top down, and records the full name
+## of every net, variable and sub-scope found directly in each of them.
+## Only the scopes on the path are walked, never the whole design.
+## Names that the walk cannot find (bit/part selects, escaped
+## identifiers, ..) fall back to vpi_handle_by_name, and the result is
+## kept in the index as well.
+##
+## The index owns the handles that it hands out; callers must not
+## release them.
+
+type
+  NameIndexStats* = object
+    hits*: int        ## lookups found in the index straight away
+    misses*: int      ## lookups that were not in the index
+    walked*: int      ## misses resolved by expanding scopes on the path
+    fallbacks*: int   ## misses resolved by vpi_handle_by_name
+    failures*: int    ## names that could not be resolved at all
+    scopes*: int      ## number of scopes expanded so far
+
+var
+  handles: Table[string, VpiHandle]  ## full name -> handle
+  expanded: Table[string, bool]      ## full names of the scopes already expanded
+  topsIndexed: bool                  ## true once the top-level modules are in the index
+  stats: NameIndexStats
+
+proc addChild(child: VpiHandle) =
+  let
+    fullName = $vpi_get_str(vpiFullName, child)
+  if fullName notin handles:
+    handles[fullName] = child
+
+proc indexTops() =
+  ## Record the top-level module instances.
+  for top, _ in vpiHandles2(nil, vpiModule):
+    addChild(top)
+  topsIndexed = true
+
+proc expandScope(scopeName: string; scope: VpiHandle) =
+  ## Record the full names of the nets, variables, module instances
+  ## and other scopes (generate blocks, named blocks, ..) found directly
+  ## in `scope`.
+  if vpi_get(vpiType, scope) in {vpiModule, vpiGenScope}:
+    for child, _ in scope.vpiHandles2([vpiNet, vpiModule]):
+      addChild(child)
+  for child, _ in scope.vpiHandles2([vpiVariables, vpiInternalScope]):
+    addChild(child)
+  expanded[scopeName] = true
+  inc stats.scopes
+
+proc walkTo(name: string): VpiHandle =
+  ## Expand the scopes on the path of `name`, outermost first, until
+  ## `name` itself turns up in the index.
+  if '\\' in name:
+    # Escaped identifiers can contain dots; leave those to the simulator.
+    return nil
+  if not topsIndexed:
+    indexTops()
+    if name in handles:
+      return handles[name]
+  var
+    depth = 0 # nesting of [] around the current character
+  for i, c in name:
+    case c
+    of '[': inc depth
+    of ']': dec depth
+    of '.':
+      if depth == 0:
+        let
+          scopeName = name[0 ..< i]
+          scope = handles.getOrDefault(scopeName)
+        if scope == nil:
+          return nil
+        if scopeName notin expanded:
+          expandScope(scopeName, scope)
+          if name in handles:
+            return handles[name]
+    else:
+      discard
+  # The scopes on the path were all expanded by earlier lookups.
+  return handles.getOrDefault(name)
+
+proc lookupName*(name: string): VpiHandle =
+  ## Return the handle of the object whose full hierarchical name is
+  ## `name`, or nil if there is no such object.
+  result = handles.getOrDefault(name)
+  if result != nil:
+    inc stats.hits
+    return
+  inc stats.misses
+
+  result = walkTo(name)
+  if result != nil:
+    inc stats.walked
+    return
+
+  result = vpi_handle_by_name(name.cstring, nil)
+  if result != nil:
+    inc stats.fallbacks
+    handles[name] = result
+  else:
+    inc stats.failures
+
+proc nameIndexStats*(): NameIndexStats =
+  ## Return the hit/miss counters of the index.
+  return stats
+
+proc reportNameIndex*(prefix = "") =
+  ## Print the size of the index and its hit/miss counters.
+  vpiEcho &"{prefix}name index: {handles.len} names, {stats.scopes} scopes expanded"
+  vpiEcho &"{prefix}  lookups: {stats.hits + stats.misses} ({stats.hits} hits, {stats.misses} misses)"
+  vpiEcho &"{prefix}  misses: {stats.walked} found by walking, {stats.fallbacks} by vpi_handle_by_name, {stats.failures} not found"
+
+proc clearNameIndex*(release = true) =
+  ## Forget everything in the index, releasing all of its handles,
+  ## e.g. when the simulation is reset.  After a restart of the
+  ## simulation the handles are no longer valid, and must not be
+  ## released (`release` = false).
+  if release:
+    for _, handle in handles:
+      discard vpi_release_handle(handle)
+  handles.clear()
+  expanded.clear()
+  topsIndexed = false
+  stats = NameIndexStats()
@@ -0,0 +1,91 @@
+import svvpi
+import async_file, common
+
+## Buffered output of the examples' text, in place of one vpiEcho
+## (vpi_printf) per line.
+##
+## `echoLine` only appends to an in-memory buffer.  The buffer is
+## written to the simulator log, in a few large vpi_printf calls, when
+## it is full, when a task calls `flushOutput` (at the end of its
+## calltf), and at the end of the simulation.
+##
+## With the plusarg +vpi_out=<file>, the lines go to that file instead,
+## through the write-behind buffer of async_file.nim, which is written
+## out when full and at the end of the simulation.
+##
+## Build with -d:echoOutput to go back to one vpiEcho per line, e.g. to
+## compare the two.
+
+const
+  outputBufferSize {.intdefine.} = 1 shl 20  ## bytes buffered before writing out
+  logChunk = 16 * 1024                        ## bytes per vpi_printf call
+
+var
+  buf: string
+  file: AsyncFile        ## the +vpi_out file, nil when writing to the log
+  initialized: bool
+  endCallback: VpiHandle
+
+proc writeOut() =
+  ## Write the buffer out to the log, and empty it.  vpi_printf is given
+  ## a chunk at a time, each NUL-terminated in place.
+  var
+    pos = 0
+  while pos < buf.len:
+    let
+      last = min(pos + logChunk, buf.len)
+      saved = if last < buf.len: buf[last] else: '\0'
+    if last < buf.len:
+      buf[last] = '\0'
+    discard vpi_printf("%s", cast[cstring](addr buf[pos]))
+    if last < buf.len:
+      buf[last] = saved
+    pos = last
+  buf.setLen(0)
+
+proc endOfSimCallback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## Write out what is left, and close the +vpi_out file.
+  writeOut()
+  if file != nil:
+    file.close()
+    file = nil
+  return vpiCbSuccess
+
+proc initOutput() =
+  ## Pick the target on first use, and arrange for the final flush.
+  initialized = true
+  let
+    path = plusarg("vpi_out")
+  if path.len > 0:
+    file = openAsyncFile(path)
+    if file == nil:
+      vpiEcho "*W,OUTPUT_SINK: could not open " & path & " for writing, using the log"
+  if file == nil:
+    buf = newStringOfCap(outputBufferSize + 256)
+  var
+    cbData = s_cb_data(reason: cbEndOfSimulation,
+                       cb_rtn: endOfSimCallback)
+  endCallback = vpi_register_cb(addr cbData)
+
+proc echoLine*(line: string) =
+  ## Output `line`, followed by a newline.
+  when defined(echoOutput):
+    vpiEcho line
+  else:
+    if not initialized:
+      initOutput()
+    if file != nil:
+      file.write(line)
+      file.write("\n")
+    else:
+      buf.add(line)
+      buf.add('\n')
+      if buf.len >= outputBufferSize:
+        writeOut()
+
+proc flushOutput*() =
+  ## Write what was output so far to the log.  Tasks call this at the
+  ## end of their calltf, so that their output is not held back behind
+  ## the simulator's own.  The +vpi_out file is left to fill up.
+  when not defined(echoOutput):
+    writeOut()
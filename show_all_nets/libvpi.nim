@@ -1,5 +1,6 @@
 import std/[strformat]
 import svvpi
+import ../def_layout, ../output_sink
 
 vpiDefine task show_all_nets:
   compiletf:
@@ -16,22 +17,24 @@ vpiDefine task show_all_nets:
       currentTime = s_vpi_time(`type`: vpiScaledRealTime)
     vpi_get_time(systfHandle, addr currentTime)
 
+    # The names of the nets come from the layout of the module's
+    # definition, which is looked up once per definition.
+    var
+      netHandles: seq[VpiHandle]
     for _, moduleHandle in systfHandle.vpiArgs:
       let
         instPath = $vpi_get_str(vpiFullName, moduleHandle)
-        moduleName = $vpi_get_str(vpiDefName, moduleHandle)
-      vpiEcho &"\nAt time {currentTime.real:2.2f}, nets in module {instPath} ({moduleName}):"
-      # Obtain handles to nets in module and read current value.
-      for netHandle, netIter in moduleHandle.vpiHandles2(vpiNet, allowNilYield = true):
-        if netIter == nil:
-          vpiEcho "  no nets found in this module"
-        elif netHandle == nil:
-          break
-        else:
-          var
-            currentValue = s_vpi_value(format: vpiBinStrVal) # read values as a string
-          vpi_get_value(netHandle, addr currentValue)
-          vpiEcho &"  net {$vpi_get_str(vpiName, netHandle):<10} value is {currentValue.value.str} (binary)"
+        layout = getLayout(moduleHandle, netHandles)
+      echoLine &"\nAt time {currentTime.real:2.2f}, nets in module {instPath} ({layout.defName}):"
+      # Read the current value of the nets in module.
+      if layout.nNets == 0:
+        echoLine "  no nets found in this module"
+      for i in 0 ..< layout.nNets:
+        var
+          currentValue = s_vpi_value(format: vpiBinStrVal) # read values as a string
+        vpi_get_value(netHandles[i], addr currentValue)
+        echoLine &"  net {layout.name(i):<10} value is {currentValue.value.str} (binary)"
+    flushOutput()
 
 
 setVlogStartupRoutines(show_all_nets)
@@ -1,37 +1,417 @@
-import std/[strformat, strutils]
+import std/[algorithm, strformat, strutils, tables]
 import svvpi
+import ../def_layout, ../output_sink
 
-proc printSignalValues*(sigHandle: VpiHandle) =
+type
+  Radix* = enum
+    radixBin = "binary"
+    radixHex = "hex"
+    radixDec = "decimal"
+
+const
+  valueRadix {.strdefine.} = "binary"  ## default radix, e.g. -d:valueRadix=hex
+  defaultRadix* = parseEnum[Radix](valueRadix)
+
+when defined(strValues):
+  # The original path: the simulator formats each value as a string,
+  # and strformat builds a new line around it.
+  proc printSignalValues*(sigHandle: VpiHandle; radix = defaultRadix) =
+    let
+      sigType = vpi_get(vpiType, sigHandle)
+      sigName = $vpi_get_str(vpiName, sigHandle)
+    var
+      currentValue = s_vpi_value()
+
+    case sigType
+    of vpiNet, vpiReg:
+      let
+        str = if sigType == vpiNet:
+                "net"
+              else:
+                "reg"
+      currentValue.format = [vpiBinStrVal, vpiHexStrVal, vpiDecStrVal][radix.ord]
+      vpi_get_value(sigHandle, addr currentValue);
+      when not defined(benchNoEcho):
+        echoLine &"  {str}     {sigName:<10}  value is  {currentValue.value.str} ({radix})"
+    of vpiIntegerVar:
+      currentValue.format = vpiIntVal;
+      vpi_get_value(sigHandle, addr currentValue);
+      when not defined(benchNoEcho):
+        echoLine &"  integer {sigName:<10}  value is  {currentValue.value.integer} (decimal)"
+    of vpiRealVar:
+      currentValue.format = vpiRealVal;
+      vpi_get_value(sigHandle, addr currentValue);
+      when not defined(benchNoEcho):
+        echoLine &"  real    {sigName:<10}  value is  {currentValue.value.real:0.2f}"
+    of vpiTimeVar:
+      currentValue.format = vpiTimeVal;
+      vpi_get_value(sigHandle, addr currentValue);
+      let
+        timeHighStr = currentValue.value.time.high.toHex(8) # return 8 char wide hex string
+        timeLowStr = currentValue.value.time.low.toHex(8)
+      when not defined(benchNoEcho):
+        echoLine &"  time    {sigName:<10}  value is  {timeHighStr}{timeLowStr}"
+    else:
+      discard
+
+else:
+  # The value is read once as vpiVectorVal, and rendered by the code
+  # below straight into a line buffer that is reused from one signal
+  # to the next, so printing a signal allocates nothing.
+
+  const
+    bitChars = "01zx"  ## indexed by aval bit + 2 * bval bit
+    hexChars = "0123456789abcdef"
+
+  proc makeBinTable(): array[256, array[8, char]] =
+    for b in 0 .. 255:
+      for i in 0 .. 7:
+        result[b][i] = if (b and (0x80 shr i)) != 0: '1' else: '0'
+
+  const
+    binTable = makeBinTable()  ## the 8 binary digits of each byte, msb first
+
+  var
+    lineBuf: string        ## the line being printed
+    decWords: seq[uint32]  ## scratch space of the decimal conversion
+
+  type
+    VecVals* = ptr UncheckedArray[s_vpi_vecval]
+
+  proc aval(vec: VecVals; w: int): uint32 {.inline.} = cast[uint32](vec[w].aval)
+  proc bval(vec: VecVals; w: int): uint32 {.inline.} = cast[uint32](vec[w].bval)
+
+  proc addBin*(buf: var string; vec: VecVals; size: int) =
+    ## Append the `size` bits of `vec` as binary digits (0, 1, z, x),
+    ## most significant first.  Whole bytes without x/z bits are copied
+    ## from a table, 8 digits at a time.
+    var
+      pos = buf.len
+      i = size - 1
+    buf.setLen(pos + size)
+    # The bits above the last whole byte, one by one.
+    while i >= 0 and (i and 7) != 7:
+      buf[pos] = bitChars[(((vec.aval(i shr 5) shr (i and 31)) and 1) or
+                           (((vec.bval(i shr 5) shr (i and 31)) and 1) shl 1)).int]
+      inc pos
+      dec i
+    while i >= 0:
+      let
+        sh = (i and 31) - 7
+        a = (vec.aval(i shr 5) shr sh) and 0xff
+        b = (vec.bval(i shr 5) shr sh) and 0xff
+      if b == 0:
+        copyMem(addr buf[pos], unsafeAddr binTable[a][0], 8)
+      else:
+        for j in 0 .. 7:
+          buf[pos + j] = bitChars[(((a shr (7 - j)) and 1) or (((b shr (7 - j)) and 1) shl 1)).int]
+      pos += 8
+      i -= 8
+
+  proc addHex*(buf: var string; vec: VecVals; size: int) =
+    ## Append the `size` bits of `vec` as hex digits, most significant
+    ## first.  As with %h, a digit with all of its bits x (z) is "x"
+    ## ("z"), and one with only some of them x (z) is "X" ("Z").
+    for d in countdown((size + 3) div 4 - 1, 0):
+      let
+        mask = (1'u32 shl min(4, size - d * 4)) - 1
+        a = (vec.aval(d shr 3) shr ((d and 7) * 4)) and mask
+        b = (vec.bval(d shr 3) shr ((d and 7) * 4)) and mask
+      if b == 0:
+        buf.add(hexChars[a.int])
+      elif b == mask and a == mask:
+        buf.add('x')
+      elif b == mask and a == 0:
+        buf.add('z')
+      elif (a and b) != 0:
+        buf.add('X')
+      else:
+        buf.add('Z')
+
+  proc addDec*(buf: var string; vec: VecVals; size: int) =
+    ## Append the `size` bits of `vec` as an unsigned decimal number.
+    ## As with %d, a value with x/z bits is "x" or "z" if all of its
+    ## bits are, and "X" or "Z" otherwise.
+    let
+      nWords = (size + 31) div 32
+      topMask = if (size and 31) == 0: high(uint32) else: (1'u32 shl (size and 31)) - 1
+    var
+      anyX, anyZ = false
+      allX, allZ = true
+    for w in 0 ..< nWords:
+      let
+        mask = if w == nWords - 1: topMask else: high(uint32)
+        a = vec.aval(w) and mask
+        b = vec.bval(w) and mask
+      anyX = anyX or (a and b) != 0
+      anyZ = anyZ or (b and not a) != 0
+      allX = allX and (a and b) == mask
+      allZ = allZ and (b and not a) == mask
+    if anyX or anyZ:
+      buf.add(if allX: 'x' elif allZ: 'z' elif anyX: 'X' else: 'Z')
+      return
+
+    # Divide by 10^9 over and over, and collect the remainders' digits
+    # in reverse.
+    decWords.setLen(nWords)
+    for w in 0 ..< nWords:
+      decWords[w] = vec.aval(w) and (if w == nWords - 1: topMask else: high(uint32))
+    var
+      n = nWords
+    while n > 0 and decWords[n - 1] == 0:
+      dec n
+    let
+      start = buf.len
+    while true:
+      var
+        rem = 0'u64
+      for w in countdown(n - 1, 0):
+        let
+          cur = (rem shl 32) or decWords[w].uint64
+        decWords[w] = uint32(cur div 1_000_000_000)
+        rem = cur mod 1_000_000_000
+      while n > 0 and decWords[n - 1] == 0:
+        dec n
+      if n > 0:
+        for _ in 1 .. 9:
+          buf.add(char(ord('0') + int(rem mod 10)))
+          rem = rem div 10
+      else:
+        while true:
+          buf.add(char(ord('0') + int(rem mod 10)))
+          rem = rem div 10
+          if rem == 0:
+            break
+        break
+    buf.toOpenArray(start, buf.high).reverse()
+
+  proc addValue*(buf: var string; vec: VecVals; size: int; radix: Radix) =
+    ## Append the `size` bits of `vec` in `radix`.
+    case radix
+    of radixBin: buf.addBin(vec, size)
+    of radixHex: buf.addHex(vec, size)
+    of radixDec: buf.addDec(vec, size)
+
+  proc addName(buf: var string; name: cstring; width: int) =
+    ## Append `name`, left-aligned in `width` columns.
+    let
+      start = buf.len
+    buf.add(name)
+    for _ in buf.len - start ..< width:
+      buf.add(' ')
+
+  type
+    Formatter* = proc (buf: var string; value: var s_vpi_value; size: int) {.nimcall.}
+      ## Appends a value read with the format that goes with it.
+
+  proc formatBin(buf: var string; value: var s_vpi_value; size: int) =
+    buf.addBin(cast[VecVals](value.value.vector), size)
+    buf.add(" (binary)")
+
+  proc formatHex(buf: var string; value: var s_vpi_value; size: int) =
+    buf.addHex(cast[VecVals](value.value.vector), size)
+    buf.add(" (hex)")
+
+  proc formatDec(buf: var string; value: var s_vpi_value; size: int) =
+    buf.addDec(cast[VecVals](value.value.vector), size)
+    buf.add(" (decimal)")
+
+  proc formatInteger(buf: var string; value: var s_vpi_value; size: int) =
+    let
+      vec = cast[VecVals](value.value.vector)
+    if vec.bval(0) == 0:
+      buf.addInt(cast[int32](vec.aval(0)))
+    else:
+      buf.addDec(vec, size)
+    buf.add(" (decimal)")
+
+  proc formatReal(buf: var string; value: var s_vpi_value; size: int) =
+    buf.formatValue(value.value.real, "0.2f")
+
+  proc formatTime(buf: var string; value: var s_vpi_value; size: int) =
+    let
+      vec = cast[VecVals](value.value.vector)
+    for w in [1, 0]:
+      for d in countdown(7, 0):
+        buf.add(hexChars[((vec.aval(w) shr (d * 4)) and 0xf).int].toUpperAscii)
+
+  proc lookupFormat*(sigType: int; radix: Radix; format: var cint; kindLabel: var string; formatter: var Formatter): bool =
+    ## Find how to read and print a signal of type `sigType`: the value
+    ## format to read it with, the label of its kind, and the formatter
+    ## of the value.  False if signals of that type are not printed.
+    format = vpiVectorVal
+    case sigType
+    of vpiNet, vpiReg:
+      kindLabel = if sigType == vpiNet: "  net     " else: "  reg     "
+      formatter = [formatBin.Formatter, formatHex, formatDec][radix.ord]
+    of vpiIntegerVar:
+      kindLabel = "  integer "
+      formatter = formatInteger
+    of vpiRealVar:
+      format = vpiRealVal
+      kindLabel = "  real    "
+      formatter = formatReal
+    of vpiTimeVar:
+      kindLabel = "  time    "
+      formatter = formatTime
+    else:
+      return false
+    return true
+
+  proc printSignalValues*(sigHandle: VpiHandle; radix = defaultRadix) =
+    var
+      format: cint
+      kindLabel: string
+      formatter: Formatter
+    if not lookupFormat(vpi_get(vpiType, sigHandle), radix, format, kindLabel, formatter):
+      return
+    var
+      currentValue = s_vpi_value(format: format)
+    vpi_get_value(sigHandle, addr currentValue)
+
+    lineBuf.setLen(0)
+    lineBuf.add(kindLabel)
+    lineBuf.addName(vpi_get_str(vpiName, sigHandle), 10)
+    lineBuf.add("  value is  ")
+    formatter(lineBuf, currentValue, if format == vpiVectorVal: vpi_get(vpiSize, sigHandle).int else: 64)
+    when not defined(benchNoEcho):
+      echoLine lineBuf
+
+# Access plans.
+#
+# A scope printed over and over has the same signals every time, so
+# everything about them except their values can be looked up once: a
+# plan is a flat array of the scope's signals, each with its handle,
+# the value format to read it with, the start of its output line (kind
+# and name, interned in one string for the whole plan), and the
+# formatter of its value.  Running the plan is then one vpi_get_value
+# per signal, and no other VPI traffic.
+#
+# All but the handles comes from the layout of the scope's definition
+# (see ../def_layout.nim), and is shared by the plans of all the
+# instances of that layout, so that it is worked out once per
+# definition rather than once per instance.
+
+type
+  PlanEntry* = object
+    signal*: int          ## index of the signal in the layout
+    format*: cint         ## vpiVectorVal or vpiRealVal
+    size*: int            ## number of bits
+    labelStart, labelLen: int  ## the start of the output line, in `labels`
+    when not defined(strValues):
+      formatter: Formatter
+
+  PlanShape = ref object
+    ## The part of a plan shared by the instances of a layout.
+    entries: seq[PlanEntry]
+    labels: string        ## output line starts of all entries, back to back
+
+  ScopePlan* = object
+    scope*: VpiHandle
+    name*: string         ## full name of the scope
+    defName*: string      ## vpiDefName of the scope, "" if it has none
+    total*: int           ## number of signals in the scope, printed or not
+    handles*: seq[VpiHandle]  ## one per entry
+    shape: PlanShape
+
+  ScopeSnapshot* = object
+    ## The values of a plan's signals at the previous call, for
+    ## +show_changed (see ../show_all_signals2/libvpi.nim).
+    words*: seq[uint32]
+    valid*: bool          ## false until the first call has filled `words`
+
+  CallPlans* = ref object
+    plans*: seq[ScopePlan]  ## one per scope shown by the task call
+    snapshots*: seq[ScopeSnapshot]  ## one per plan, if the task call keeps them
+
+var
+  shapes: Table[(int, Radix), PlanShape]  ## (layout id, radix) -> shape
+
+proc entries*(plan: ScopePlan): lent seq[PlanEntry] {.inline.} =
+  ## The signals printed by the plan, in the order of `handles`.
+  return plan.shape.entries
+
+proc addEntry(shape: PlanShape; layout: DefLayout; i: int; radix: Radix) =
+  ## Add signal `i` of the layout, unless it is of a type that is not
+  ## printed.
   let
-    sigType = vpi_get(vpiType, sigHandle)
-    sigName = $vpi_get_str(vpiName, sigHandle)
+    s = layout.signals[i]
+  var
+    entry = PlanEntry(signal: i, format: s.format)
+  when defined(strValues):
+    if s.sigType notin {vpiNet, vpiReg, vpiIntegerVar, vpiRealVar, vpiTimeVar}:
+      return
+  else:
+    var
+      kindLabel: string
+    if not lookupFormat(s.sigType, radix, entry.format, kindLabel, entry.formatter):
+      return
+  entry.size = if entry.format == vpiVectorVal: s.size.int else: 64
+  entry.labelStart = shape.labels.len
+  when not defined(strValues):
+    shape.labels.add(kindLabel)
+    let
+      nameStart = shape.labels.len
+    shape.labels.addName(layout, i)
+    for _ in shape.labels.len - nameStart ..< 10:
+      shape.labels.add(' ')
+    shape.labels.add("  value is  ")
+  entry.labelLen = shape.labels.len - entry.labelStart
+  shape.entries.add(entry)
+
+proc buildPlan*(scope: VpiHandle; radix = defaultRadix): ScopePlan =
+  ## Build the plan of the nets and variables found directly in `scope`.
+  result.scope = scope
+  result.name = $vpi_get_str(vpiFullName, scope)
+  # Nets can only exist if scope is a module.
+  # Note that IEEE 1800-2005 onwards, vpiVariables includes vpiReg
+  # and vpiRegArrays.
   var
-    currentValue = s_vpi_value()
-
-  case sigType
-  of vpiNet, vpiReg:
-    let
-      str = if sigType == vpiNet:
-              "net"
-            else:
-              "reg"
-    currentValue.format = vpiBinStrVal;
-    vpi_get_value(sigHandle, addr currentValue);
-    vpiEcho &"  {str}     {sigName:<10}  value is  {currentValue.value.str} (binary)"
-  of vpiIntegerVar:
-    currentValue.format = vpiIntVal;
-    vpi_get_value(sigHandle, addr currentValue);
-    vpiEcho &"  integer {sigName:<10}  value is  {currentValue.value.integer} (decimal)"
-  of vpiRealVar:
-    currentValue.format = vpiRealVal;
-    vpi_get_value(sigHandle, addr currentValue);
-    vpiEcho &"  real    {sigName:<10}  value is  {currentValue.value.real:0.2f}"
-  of vpiTimeVar:
-    currentValue.format = vpiTimeVal;
-    vpi_get_value(sigHandle, addr currentValue);
-    let
-      timeHighStr = currentValue.value.time.high.toHex(8) # return 8 char wide hex string
-      timeLowStr = currentValue.value.time.low.toHex(8)
-    vpiEcho &"  time    {sigName:<10}  value is  {timeHighStr}{timeLowStr}"
+    signalHandles: seq[VpiHandle]
+  let
+    layout = getLayout(scope, signalHandles)
+  result.defName = layout.defName
+  result.total = layout.len
+  if layout.id >= 0:
+    result.shape = shapes.getOrDefault((layout.id, radix))
+  if result.shape == nil:
+    result.shape = PlanShape()
+    for i in 0 ..< layout.len:
+      result.shape.addEntry(layout, i, radix)
+    if layout.id >= 0:
+      shapes[(layout.id, radix)] = result.shape
+  for e in result.shape.entries:
+    result.handles.add(signalHandles[e.signal])
+
+proc printEntry*(plan: ScopePlan; i: int; value: var s_vpi_value) =
+  ## Print entry `i` of the plan, whose value has been read into `value`.
+  when defined(strValues):
+    plan.handles[i].printSignalValues()
   else:
-    discard
+    let
+      e = addr plan.shape.entries[i]
+    lineBuf.setLen(e.labelLen)
+    if e.labelLen > 0:
+      copyMem(addr lineBuf[0], unsafeAddr plan.shape.labels[e.labelStart], e.labelLen)
+    e.formatter(lineBuf, value, e.size)
+    when not defined(benchNoEcho):
+      echoLine lineBuf
+
+proc runPlan*(plan: ScopePlan) =
+  ## Print all the signals of the plan.
+  for i, e in plan.shape.entries:
+    var
+      currentValue = s_vpi_value(format: e.format)
+    vpi_get_value(plan.handles[i], addr currentValue)
+    plan.printEntry(i, currentValue)
+
+proc getCallPlans*(systfHandle: VpiHandle): CallPlans =
+  ## Get the plans of a task call from its userdata, creating an empty
+  ## set of plans on the first call.
+  result = cast[CallPlans](systfHandle.vpi_get_userdata())
+  if result == nil:
+    result = CallPlans()
+    # Do not garbage-collect this object as we need it for the entire
+    # simulation.
+    GC_ref(result)
+    discard systfHandle.vpi_put_userdata(cast[pointer](result))
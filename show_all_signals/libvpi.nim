@@ -1,5 +1,6 @@
 import std/[strformat]
 import svvpi
+import ../output_sink
 import common
 
 vpiDefine task show_all_signals:
@@ -17,17 +18,19 @@ vpiDefine task show_all_signals:
       currentTime = s_vpi_time(`type`: vpiScaledRealTime)
     vpi_get_time(systfHandle, addr currentTime)
 
-    for _, moduleHandle in systfHandle.vpiArgs:
-      let
-        instPath = $vpi_get_str(vpiFullName, moduleHandle)
-        moduleName = $vpi_get_str(vpiDefName, moduleHandle)
-      vpiEcho &"\nAt time {currentTime.real:2.2f}, signals in module {instPath} ({moduleName}):"
-      # Obtain handles to signals in module and read current value.
-      # Note that IEEE 1800-2005 onwards, vpiVariables includes vpiReg
-      # and vpiRegArrays. See section "36.12.1 VPI Incompatibilities
-      # with other standard versions" of IEEE 1800-2017.
-      for sigHandle, _ in moduleHandle.vpiHandles2([vpiNet, vpiVariables]):
-        sigHandle.printSignalValues()
+    # The plans of the module arguments are built on the first call,
+    # and kept in the userdata of this task call.
+    let
+      callPlans = systfHandle.getCallPlans()
+    if callPlans.plans.len == 0:
+      for _, moduleHandle in systfHandle.vpiArgs:
+        callPlans.plans.add(buildPlan(moduleHandle))
+
+    for plan in callPlans.plans:
+      echoLine &"\nAt time {currentTime.real:2.2f}, signals in module {plan.name} ({plan.defName}):"
+      # Read the current values of the signals in module.
+      plan.runPlan()
+    flushOutput()
 
 
 setVlogStartupRoutines(show_all_signals)
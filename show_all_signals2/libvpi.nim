@@ -1,7 +1,59 @@
 import std/[strformat]
 import svvpi
+import ../common, ../output_sink
 import ../show_all_signals/common
 
+## The scopes to show, and their signals, are looked up on the first
+## call only: each task call keeps an access plan per scope (see
+## ../show_all_signals/common.nim) in its userdata, and later calls
+## just run the plans.
+##
+## With the plusarg +show_changed, each call prints only the signals
+## whose value changed since the previous call from the same place
+## (same task call and scope), plus a count of the signals seen,
+## compared and changed.  The first call prints everything.
+##
+## The previous values of a scope's signals are kept next to its plan,
+## in one packed buffer per scope: the aval/bval words of each signal in plan order
+## (real values are kept as their 64 bits).  A call reads each value
+## once and compares it word by word with the buffer.
+
+var
+  showChanged = -1  ## +show_changed: -1 until looked up, then 0 or 1
+
+proc showChangedSignals(plan: ScopePlan; snap: var ScopeSnapshot) =
+  ## Print the signals of the plan whose value differs from the
+  ## snapshot, and update the snapshot.
+  var
+    pos = 0
+    changed = 0
+  for i, e in plan.entries:
+    var
+      currentValue = s_vpi_value(format: e.format)
+    vpi_get_value(plan.handles[i], addr currentValue)
+    let
+      words = if e.format == vpiRealVal: cast[ptr UncheckedArray[uint32]](addr currentValue.value.real)
+              else: cast[ptr UncheckedArray[uint32]](currentValue.value.vector)
+      n = if e.format == vpiRealVal: 2 else: 2 * ((e.size + 31) div 32)
+    if not snap.valid:
+      for j in 0 ..< n:
+        snap.words.add(words[j])
+      plan.printEntry(i, currentValue)
+      continue
+    var
+      differs = false
+    for j in 0 ..< n:
+      if snap.words[pos + j] != words[j]:
+        snap.words[pos + j] = words[j]
+        differs = true
+    pos += n
+    if differs:
+      inc changed
+      plan.printEntry(i, currentValue)
+  if snap.valid:
+    echoLine &"  signals: {plan.total} total, {plan.entries.len} compared, {changed} changed"
+  snap.valid = true
+
 vpiDefine task show_all_signals:
   compiletf:
     when not defined(multipleArgs):
@@ -26,39 +78,40 @@ vpiDefine task show_all_signals:
     var
       currentTime = s_vpi_time(`type`: vpiScaledRealTime)
     vpi_get_time(systfHandle, addr currentTime)
+    if showChanged < 0:
+      showChanged = hasPlusarg("show_changed").int
 
-    for argHandle, argIter in systfHandle.vpiHandles2(vpiArgument, allowNilYield = true):
-      var
-        scopeHandle: VpiHandle
-      if argIter == nil:
-        # no arguments -- use scope that called this application
-        scopeHandle = systfHandle.vpi_handle(vpiScope)
-      elif argHandle == nil:
-        # quit the iteration if we end up with a nil argHandle
-        break
-      else:
-        if vpi_get(vpiType, argHandle) in {vpiOperation}:
-          # null task -- use scope that called this application
+    # The plans of the scopes are built on the first call.
+    let
+      callPlans = systfHandle.getCallPlans()
+    if callPlans.plans.len == 0:
+      for argHandle, argIter in systfHandle.vpiHandles2(vpiArgument, allowNilYield = true):
+        var
+          scopeHandle: VpiHandle
+        if argIter == nil:
+          # no arguments -- use scope that called this application
           scopeHandle = systfHandle.vpi_handle(vpiScope)
+        elif argHandle == nil:
+          # quit the iteration if we end up with a nil argHandle
+          break
         else:
-          # .. otherwise, use the scope from the argument
-          scopeHandle = argHandle
-
-      let
-        scopeName = $vpi_get_str(vpiFullName, scopeHandle)
-      vpiEcho &"\nAt time {currentTime.real:2.2f}, signals in scope {scopeName}:"
+          if vpi_get(vpiType, argHandle) in {vpiOperation}:
+            # null task -- use scope that called this application
+            scopeHandle = systfHandle.vpi_handle(vpiScope)
+          else:
+            # .. otherwise, use the scope from the argument
+            scopeHandle = argHandle
+        callPlans.plans.add(buildPlan(scopeHandle))
+      callPlans.snapshots.setLen(callPlans.plans.len)
 
-      # Obtain handles to nets in module and read current value.
-      # Nets can only exist if scope is a module.
-      if vpi_get(vpiType, scopeHandle) in {vpiModule}:
-        for netHandle, _ in scopeHandle.vpiHandles2(vpiNet):
-          netHandle.printSignalValues()
-
-      # Note that IEEE 1800-2005 onwards, vpiVariables includes vpiReg
-      # and vpiRegArrays. See section "36.12.1 VPI Incompatibilities
-      # with other standard versions" of IEEE 1800-2017.
-      for sigHandle, _ in scopeHandle.vpiHandles2(vpiVariables):
-        sigHandle.printSignalValues()
+    for i in 0 ..< callPlans.plans.len:
+      echoLine &"\nAt time {currentTime.real:2.2f}, signals in scope {callPlans.plans[i].name}:"
+      # Read the current values of the signals in the scope.
+      if showChanged == 1:
+        callPlans.plans[i].showChangedSignals(callPlans.snapshots[i])
+      else:
+        callPlans.plans[i].runPlan()
+    flushOutput()
 
 
 setVlogStartupRoutines(show_all_signals)
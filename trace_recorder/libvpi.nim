@@ -0,0 +1,269 @@
+import std/[strformat]
+import svvpi
+import ../async_file
+import trace_format
+
+## $trace_record(scope, file) records the value-changes of all the nets
+## and variables found directly in `scope` (the same vpiNet/vpiVariables
+## iteration as $show_all_signals) to the binary trace file `file`, from
+## the time of the call to the end of the simulation.  See
+## trace_format.nim for the layout of the file, and trace_reader.nim
+## for reading it back.
+##
+## Each signal collects its changes in a chunk of its own, each value
+## stored as its XOR with the previous one, in runs of zero and
+## literal bytes (see trace_format.nim).  A chunk
+## that reaches `chunkBytes` is appended to the file straight away
+## (through the write-behind buffer of ../async_file.nim), so the file
+## is written sequentially; only the index, the hierarchy and the
+## trailer wait for the end of the simulation.
+
+const
+  chunkBytes = 4096
+
+type
+  RecordedSignal = object
+    obj: VpiHandle
+    name: string
+    size: int
+    kind: SignalKind
+    trace: int               ## index of the trace it belongs to
+    chunk: seq[byte]         ## records not yet written to the file
+    prev: seq[byte]          ## aval and bval bytes of the last record in `chunk`
+    count: int               ## records in `chunk`
+    firstTime, lastTime: int64
+    blocks: seq[BlockEntry]  ## chunks already written
+
+  Trace = object
+    file: AsyncFile
+    written: int64           ## bytes written to the file so far
+    signals: seq[int]        ## indices of its signals in `signals`
+
+var
+  traces: seq[Trace]
+  signals: seq[RecordedSignal]
+  endCallback: VpiHandle
+  scratch: seq[byte]         ## the bytes of the value being recorded
+
+proc writeChunk(sig: var RecordedSignal) =
+  ## Append the signal's pending records to its trace file as one chunk.
+  if sig.count == 0:
+    return
+  let
+    t = addr traces[sig.trace]
+  sig.blocks.add(BlockEntry(offset: t.written,
+                            firstTime: sig.firstTime,
+                            lastTime: sig.lastTime,
+                            length: sig.chunk.len.uint32,
+                            count: sig.count.uint32))
+  t.file.write(addr sig.chunk[0], sig.chunk.len)
+  t.written += sig.chunk.len
+  sig.chunk.setLen(0)
+  sig.count = 0
+
+proc addRecord(sig: var RecordedSignal; time: int64; valuePtr: p_vpi_value) =
+  ## Encode a value of the signal, as obtained from VPI, at the end of
+  ## its chunk: its bytes are XORed with those of the previous value,
+  ## and stored as runs.
+  let
+    n = if sig.kind == skReal: 8 else: valueBytes(sig.size)
+  if sig.count == 0:
+    sig.firstTime = time
+    sig.lastTime = time
+    # Each chunk starts from a value of all zeros.
+    sig.prev.setLen(0)
+    sig.prev.setLen(2 * n)
+  let
+    dt = (time - sig.lastTime).uint64 shl 1
+  sig.lastTime = time
+  inc sig.count
+
+  # The aval bytes, then the bval bytes, of the value.
+  scratch.setLen(2 * n)
+  if sig.kind == skReal:
+    copyMem(addr scratch[0], addr valuePtr.value.real, 8)
+    zeroMem(addr scratch[n], n)
+  else:
+    let
+      vec = cast[ptr UncheckedArray[s_vpi_vecval]](valuePtr.value.vector)
+    for b in 0 ..< n:
+      let
+        sh = (b and 3) * 8
+      scratch[b] = byte((cast[uint32](vec[b shr 2].aval) shr sh) and 0xff)
+      scratch[n + b] = byte((cast[uint32](vec[b shr 2].bval) shr sh) and 0xff)
+  var
+    xzChanged = false
+  for k in 0 ..< 2 * n:
+    let
+      value = scratch[k]
+    scratch[k] = value xor sig.prev[k]
+    sig.prev[k] = value
+    if k >= n and scratch[k] != 0:
+      xzChanged = true
+  sig.chunk.putVarint(dt or xzChanged.uint64)
+  sig.chunk.putRuns(scratch.toOpenArray(0, n - 1))
+  if xzChanged:
+    sig.chunk.putRuns(scratch.toOpenArray(n, 2 * n - 1))
+
+  if sig.chunk.len >= chunkBytes:
+    sig.writeChunk()
+
+proc valueChangeCallback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## Value-change callback of a recorded signal, whose index is in the
+  ## callback's user_data.
+  let
+    i = cast[int](cbDataPtr.user_data)
+  signals[i].addRecord((cbDataPtr.time.high.int64 shl 32) or cbDataPtr.time.low.int64, cbDataPtr.value)
+  return vpiCbSuccess
+
+proc finishTrace(t: var Trace) =
+  ## Write out the pending chunks, then the index, the hierarchy and
+  ## the trailer, and close the file.
+  for i in t.signals:
+    signals[i].writeChunk()
+
+  # Align the index.
+  let
+    pad = (8 - (t.written and 7)) and 7
+    zeros = [0'u8, 0, 0, 0, 0, 0, 0, 0]
+  t.file.write(unsafeAddr zeros[0], pad.int)
+  t.written += pad
+
+  var
+    trailer = TraceTrailer(indexOffset: t.written,
+                           nSignals: t.signals.len,
+                           precision: vpi_get(vpiTimePrecision, nil).int32,
+                           version: traceVersion)
+  for i in t.signals:
+    for b in signals[i].blocks:
+      var
+        entry = b
+      t.file.write(addr entry, sizeof(BlockEntry))
+    trailer.nBlocks += signals[i].blocks.len
+  t.written += trailer.nBlocks * sizeof(BlockEntry)
+
+  trailer.signalsOffset = t.written
+  var
+    firstBlock = 0
+    nameOffset = 0
+  for i in t.signals:
+    let
+      sig = addr signals[i]
+    var
+      entry = SignalEntry(firstBlock: firstBlock.uint32,
+                          nBlocks: sig.blocks.len.uint32,
+                          size: sig.size.uint32,
+                          kind: sig.kind.uint32,
+                          nameOffset: nameOffset.uint32,
+                          nameLen: sig.name.len.uint32)
+    t.file.write(addr entry, sizeof(SignalEntry))
+    firstBlock += sig.blocks.len
+    nameOffset += sig.name.len
+  t.written += t.signals.len * sizeof(SignalEntry)
+
+  trailer.namesOffset = t.written
+  trailer.namesLen = nameOffset
+  for i in t.signals:
+    t.file.write(signals[i].name)
+  for j, c in traceMagic:
+    trailer.magic[j] = c
+  t.file.write(addr trailer, sizeof(TraceTrailer))
+  t.file.close()
+
+proc endOfSimCallback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## Complete and close all the traces.
+  for t in traces.mitems:
+    t.finishTrace()
+  traces.setLen(0)
+  signals.setLen(0)
+  return vpiCbSuccess
+
+proc signalKind(obj: VpiHandle; kind: var SignalKind): bool =
+  ## Find the kind of a net or variable; false if it cannot be recorded.
+  case vpi_get(vpiType, obj)
+  of vpiNet, vpiReg, vpiLogicVar, vpiBitVar, vpiByteVar, vpiShortIntVar,
+     vpiIntVar, vpiLongIntVar, vpiEnumVar, vpiIntegerVar, vpiTimeVar:
+    kind = skVector
+  of vpiRealVar:
+    kind = skReal
+  else:
+    return false
+  return true
+
+vpiDefine task trace_record:
+  compiletf:
+    systfHandle.vpiNumArgCheck(2)
+    for argIndex, argHandle in systfHandle.vpiArgs:
+      let
+        argType = vpi_get(vpiType, argHandle)
+      if argIndex == 0 and argType notin {vpiModule, vpiTask, vpiFunction, vpiNamedBegin, vpiNamedFork}:
+        vpiException &"Arg {argIndex} must be a scope instance, but its type was {argType}"
+
+  calltf:
+    var
+      scope, fileArg: VpiHandle
+    for argIndex, argHandle in systfHandle.vpiArgs:
+      if argIndex == 0:
+        scope = argHandle
+      else:
+        fileArg = argHandle
+    var
+      fileName = s_vpi_value(format: vpiStringVal)
+    vpi_get_value(fileArg, addr fileName)
+    let
+      f = openAsyncFile($fileName.value.str)
+    if f == nil:
+      vpiEcho &"*E,TRACE_RECORD: could not open {fileName.value.str} for writing"
+      return
+
+    let
+      traceIndex = traces.len
+    var
+      start = s_vpi_time(`type`: vpiSimTime)
+    vpi_get_time(nil, addr start)
+    f.write(traceMagic)
+    traces.add(Trace(file: f, written: traceMagic.len))
+
+    # Nets can only exist if scope is a module.
+    # Note that IEEE 1800-2005 onwards, vpiVariables includes vpiReg
+    # and vpiRegArrays.
+    let
+      sigTypes = if vpi_get(vpiType, scope) == vpiModule: @[vpiNet.cint, vpiVariables] else: @[vpiVariables.cint]
+    for sigType in sigTypes:
+      for sigHandle, _ in scope.vpiHandles2(sigType):
+        var
+          kind: SignalKind
+        if not sigHandle.signalKind(kind):
+          continue
+        traces[traceIndex].signals.add(signals.len)
+        signals.add(RecordedSignal(obj: sigHandle,
+                                   name: $vpi_get_str(vpiFullName, sigHandle),
+                                   size: if kind == skReal: 64 else: vpi_get(vpiSize, sigHandle),
+                                   kind: kind,
+                                   trace: traceIndex))
+
+    # Initial values, then a callback on every signal for the changes.
+    for i in traces[traceIndex].signals:
+      var
+        time_s = s_vpi_time(`type`: vpiSimTime)
+        value_s = s_vpi_value(format: if signals[i].kind == skReal: vpiRealVal else: vpiVectorVal)
+      vpi_get_value(signals[i].obj, addr value_s)
+      signals[i].addRecord((start.high.int64 shl 32) or start.low.int64, addr value_s)
+      var
+        cbData = s_cb_data(reason: cbValueChange,
+                           cb_rtn: valueChangeCallback,
+                           obj: signals[i].obj,
+                           time: addr time_s,
+                           value: addr value_s,
+                           user_data: cast[cstring](i))
+      discard vpi_register_cb(addr cbData)
+    vpiEcho &"$trace_record: recording {traces[traceIndex].signals.len} signals of {vpi_get_str(vpiFullName, scope)} to {fileName.value.str}"
+
+    if endCallback == nil:
+      var
+        cbData = s_cb_data(reason: cbEndOfSimulation,
+                           cb_rtn: endOfSimCallback)
+      endCallback = vpi_register_cb(addr cbData)
+
+
+setVlogStartupRoutines(trace_record)
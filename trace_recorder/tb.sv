@@ -0,0 +1,52 @@
+//-----------------------------------------------------------------------------
+// File:        tb.sv
+// Description: Test bench for $trace_record
+//-----------------------------------------------------------------------------
+// Counters of different widths, an integer, a real and a bus with x
+// and z bits change on every clock, and all the signals of the top
+// scope get recorded to top.trc.  "make query" reads part of it back
+// with trace_query.
+//-----------------------------------------------------------------------------
+
+`timescale 1ns / 1ps
+
+`ifndef STEPS
+  `define STEPS 100000
+`endif
+
+module top;
+
+  bit clk;
+  integer count;
+  real level;
+  logic       c1 = 0;
+  logic [7:0] c8 = 0;
+  logic [31:0] c32 = 0;
+  logic [63:0] c64 = 0;
+  logic [99:0] c100 = 0;
+  wire [3:0] bus;
+
+  assign bus = c8[0] ? 4'bz01x : c8[3:0];
+
+  always @(posedge clk) begin
+    count <= count + 1;
+    level <= level + 0.25;
+    c1 <= ~c1;
+    c8 <= c8 + 3;
+    c32 <= c32 * 5 + 1;
+    c64 <= c64 * 7 + 1;
+    c100 <= {c100[98:0], c100[99] ^ c100[63] ^ 1'b1};
+  end
+
+  initial begin
+    count = 0;
+    level = 0.0;
+    $trace_record(top, "top.trc");
+    repeat (`STEPS) begin
+      #1 clk = 1;
+      #1 clk = 0;
+    end
+    $finish;
+  end
+
+endmodule : top
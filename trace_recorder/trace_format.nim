@@ -0,0 +1,132 @@
+## Layout of the binary trace files written by $trace_record, shared by
+## the recorder (libvpi.nim) and the reader (trace_reader.nim).
+##
+## A trace file is written front to back in one go:
+##
+##   header   the 8 bytes `traceMagic`
+##   blocks   the recorded value-changes, in chunks of one signal each
+##   index    one `BlockEntry` per chunk, grouped by signal, in time
+##            order within each signal (8-byte aligned)
+##   signals  one `SignalEntry` per signal: the hierarchy
+##   names    the full names of the signals, back to back
+##   trailer  a `TraceTrailer`, which locates all of the above
+##
+## so a reader maps the file, reads the trailer at its end, and from
+## there goes straight to the chunks of one signal that cover a time
+## window, without touching the rest.
+##
+## Each chunk is a sequence of value-change records:
+##
+##   varint   (time - time of the previous record in the chunk) shl 1,
+##            or 1 if the x/z bits changed; the first record of a
+##            chunk is at the chunk's `firstTime`
+##   aval     the value's bits, XORed with those of the previous record
+##            in the chunk, as runs (see below)
+##   bval     the same for the x/z bits, only if flagged above
+##
+## The bits of a value are taken as (size + 7) div 8 bytes, least
+## significant byte first; real signals take the 8 bytes of the value,
+## and are never flagged.  The first record of a chunk is XORed with a
+## value of all zeros, so that each chunk decodes on its own.  The
+## XORed bytes, mostly zeros for a value that changes a few bits at a
+## time, are stored as runs: a varint count of zero bytes, a varint
+## count of literal bytes, those bytes, and so on, until the counts add
+## up to all the bytes of the value.
+##
+## Varints are unsigned LEB128.  Everything else is in the host's byte
+## order.
+
+const
+  traceMagic* = "VPITRC01"
+  traceVersion* = 2
+
+type
+  SignalKind* = enum
+    skVector  ## nets and integral variables
+    skReal    ## real variables
+
+  BlockEntry* = object
+    offset*: int64     ## file offset of the chunk
+    firstTime*: int64  ## time of the first record in the chunk
+    lastTime*: int64   ## time of the last record in the chunk
+    length*: uint32    ## bytes in the chunk
+    count*: uint32     ## records in the chunk
+
+  SignalEntry* = object
+    firstBlock*: uint32  ## index of the signal's first `BlockEntry`
+    nBlocks*: uint32
+    size*: uint32        ## number of bits
+    kind*: uint32        ## a `SignalKind`
+    nameOffset*: uint32  ## offset of the full name in the names
+    nameLen*: uint32
+
+  TraceTrailer* = object
+    indexOffset*: int64
+    nBlocks*: int64
+    signalsOffset*: int64
+    nSignals*: int64
+    namesOffset*: int64
+    namesLen*: int64
+    precision*: int32  ## simulation time precision, e.g. -12 for 1ps
+    version*: int32
+    magic*: array[8, char]
+
+proc putVarint*(buf: var seq[byte]; x: uint64) =
+  ## Append `x` as an unsigned LEB128 varint.
+  var
+    x = x
+  while x >= 0x80'u64:
+    buf.add(byte(x and 0x7f) or 0x80)
+    x = x shr 7
+  buf.add(byte(x))
+
+proc getVarint*(p: ptr UncheckedArray[byte]; pos: var int): uint64 =
+  ## Read the varint at `p[pos]`, and move `pos` past it.
+  var
+    shift = 0
+  while true:
+    let
+      b = p[pos]
+    inc pos
+    result = result or ((b and 0x7f).uint64 shl shift)
+    if b < 0x80:
+      break
+    shift += 7
+
+proc valueBytes*(size: int): int {.inline.} =
+  ## Bytes taken by each of aval and bval of a `size`-bit vector.
+  return (size + 7) div 8
+
+proc putRuns*(buf: var seq[byte]; delta: openArray[byte]) =
+  ## Append the bytes `delta` as runs of zero bytes and literal bytes.
+  ## A lone zero byte between two non-zero ones stays in the literal.
+  var
+    i = 0
+  while i < delta.len:
+    var
+      z = i
+    while z < delta.len and delta[z] == 0:
+      inc z
+    var
+      l = z
+    while l < delta.len and (delta[l] != 0 or (l + 1 < delta.len and delta[l + 1] != 0)):
+      inc l
+    buf.putVarint(uint64(z - i))
+    buf.putVarint(uint64(l - z))
+    for k in z ..< l:
+      buf.add(delta[k])
+    i = l
+
+proc xorRuns*(p: ptr UncheckedArray[byte]; pos: var int; dst: var openArray[byte]) =
+  ## XOR the runs at `p[pos]` into the bytes `dst`, and move `pos` past
+  ## them.
+  var
+    i = 0
+  while i < dst.len:
+    i += getVarint(p, pos).int
+    let
+      lits = getVarint(p, pos).int
+    for k in 0 ..< lits:
+      dst[i + k] = dst[i + k] xor p[pos + k]
+    pos += lits
+    i += lits
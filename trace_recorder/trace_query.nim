@@ -0,0 +1,51 @@
+import std/[os, strformat, strutils]
+import trace_format, trace_reader
+
+## Command line reader of the trace files written by $trace_record.
+##
+##   trace_query FILE [SCOPE]
+##       list the signals in the trace (those below SCOPE only)
+##   trace_query FILE SIGNAL FROM [TO]
+##       print the value of SIGNAL at time FROM and its changes up to
+##       time TO, both in units of the simulation precision
+
+proc usage() =
+  echo "Usage: trace_query FILE [SCOPE]"
+  echo "       trace_query FILE SIGNAL FROM [TO]"
+  quit(QuitFailure)
+
+proc main() =
+  if paramCount() notin 1 .. 4:
+    usage()
+  var
+    r: TraceReader
+  try:
+    r = openTrace(paramStr(1))
+  except IOError, OSError:
+    echo &"trace_query: {getCurrentExceptionMsg()}"
+    quit(QuitFailure)
+
+  if paramCount() <= 2:
+    for i in r.signalsUnder(if paramCount() == 2: paramStr(2) else: ""):
+      let
+        sig = r.signals[i]
+        kind = if sig.kind == skReal: "real" else: &"[{sig.size - 1}:0]"
+      echo &"{sig.name} {kind}"
+  else:
+    let
+      signal = r.findSignal(paramStr(2))
+    if signal < 0:
+      echo &"trace_query: no signal {paramStr(2)} in {paramStr(1)}"
+      quit(QuitFailure)
+    var
+      fromTime, toTime: int64
+    try:
+      fromTime = parseBiggestInt(paramStr(3))
+      toTime = if paramCount() == 4: parseBiggestInt(paramStr(4)) else: high(int64)
+    except ValueError:
+      usage()
+    for v in r.values(signal, fromTime, toTime):
+      echo &"{r.formatTime(v.time)}: {r.signals[signal].formatValue(v)}"
+  r.close()
+
+main()
@@ -0,0 +1,200 @@
+import std/[memfiles, strutils]
+import trace_format
+
+## Reader of the binary trace files written by $trace_record.
+##
+## The file is mapped into memory rather than read: opening a trace
+## only reads its trailer and the hierarchy, and `values` decodes only
+## the chunks of the one signal that overlap the requested time window,
+## found by a binary search of the signal's part of the block index.
+##
+## This module does not depend on VPI; trace_query.nim is a command
+## line front end to it.
+
+type
+  TraceSignal* = object
+    name*: string
+    size*: int
+    kind*: SignalKind
+    firstBlock, nBlocks: int
+
+  TraceValue* = object
+    time*: int64
+    aval*, bval*: seq[uint32]  ## for vector signals, 32 bits per word
+    real*: float64             ## for real signals
+
+  TraceReader* = object
+    file: MemFile
+    data: ptr UncheckedArray[byte]
+    blocks: ptr UncheckedArray[BlockEntry]
+    nBlocks: int
+    precision*: int             ## simulation time precision, e.g. -12 for 1ps
+    signals*: seq[TraceSignal]
+
+proc hasMagic(trailer: TraceTrailer): bool =
+  for j, c in traceMagic:
+    if trailer.magic[j] != c:
+      return false
+  return true
+
+proc openTrace*(path: string): TraceReader =
+  ## Map the trace file `path`, and read its hierarchy.
+  ## Raises IOError if the file is not a trace file.
+  result.file = memfiles.open(path)
+  result.data = cast[ptr UncheckedArray[byte]](result.file.mem)
+  let
+    size = result.file.size
+  var
+    trailer: TraceTrailer
+  if size < traceMagic.len + sizeof(TraceTrailer):
+    result.file.close()
+    raise newException(IOError, path & " is not a trace file")
+  copyMem(addr trailer, addr result.data[size - sizeof(TraceTrailer)], sizeof(TraceTrailer))
+  if not trailer.hasMagic or trailer.version != traceVersion:
+    result.file.close()
+    raise newException(IOError, path & " is not a trace file, or not of version " & $traceVersion)
+
+  result.precision = trailer.precision
+  result.blocks = cast[ptr UncheckedArray[BlockEntry]](addr result.data[trailer.indexOffset.int])
+  result.nBlocks = trailer.nBlocks.int
+  let
+    entries = cast[ptr UncheckedArray[SignalEntry]](addr result.data[trailer.signalsOffset.int])
+  for i in 0 ..< trailer.nSignals.int:
+    let
+      e = entries[i]
+    var
+      name = newString(e.nameLen.int)
+    if e.nameLen > 0:
+      copyMem(addr name[0], addr result.data[trailer.namesOffset.int + e.nameOffset.int], e.nameLen.int)
+    result.signals.add(TraceSignal(name: name,
+                                   size: e.size.int,
+                                   kind: SignalKind(e.kind),
+                                   firstBlock: e.firstBlock.int,
+                                   nBlocks: e.nBlocks.int))
+
+proc close*(r: var TraceReader) =
+  ## Unmap the trace file.
+  r.file.close()
+  r.data = nil
+  r.blocks = nil
+  r.signals.setLen(0)
+
+proc findSignal*(r: TraceReader; name: string): int =
+  ## Return the index of the signal with the full name `name`, or -1.
+  for i, sig in r.signals:
+    if sig.name == name:
+      return i
+  return -1
+
+proc firstBlockAt(r: TraceReader; sig: TraceSignal; time: int64): int =
+  ## Index of the last block of `sig` that starts at or before `time`
+  ## (or its first block, if they all start later).
+  var
+    lo = sig.firstBlock
+    hi = sig.firstBlock + sig.nBlocks - 1
+  while lo < hi:
+    let
+      mid = (lo + hi + 1) div 2
+    if r.blocks[mid].firstTime <= time:
+      lo = mid
+    else:
+      hi = mid - 1
+  return lo
+
+proc decode(r: TraceReader; sig: TraceSignal; pos: var int; time: var int64;
+            state: var seq[byte]; v: var TraceValue) =
+  ## Decode the record at `pos` into `v`, and move `pos` past it.
+  ## `time` is the time of the previous record, and `state` the aval
+  ## and bval bytes of its value, which the record's are XORed into.
+  let
+    head = getVarint(r.data, pos)
+  time += int64(head shr 1)
+  v.time = time
+  let
+    n = state.len div 2
+  xorRuns(r.data, pos, state.toOpenArray(0, n - 1))
+  if (head and 1) != 0:
+    xorRuns(r.data, pos, state.toOpenArray(n, 2 * n - 1))
+  if sig.kind == skReal:
+    copyMem(addr v.real, addr state[0], 8)
+    return
+  let
+    nWords = (sig.size + 31) div 32
+  v.aval.setLen(nWords)
+  v.bval.setLen(nWords)
+  for w in 0 ..< nWords:
+    v.aval[w] = 0
+    v.bval[w] = 0
+  for b in 0 ..< n:
+    v.aval[b shr 2] = v.aval[b shr 2] or (state[b].uint32 shl ((b and 3) * 8))
+    v.bval[b shr 2] = v.bval[b shr 2] or (state[n + b].uint32 shl ((b and 3) * 8))
+
+iterator values*(r: TraceReader; signal: int; fromTime = 0'i64; toTime = high(int64)): TraceValue =
+  ## Yield the value of signal number `signal` in effect at `fromTime`
+  ## (if it was recorded by then), followed by each of its changes up
+  ## to and including `toTime`.
+  let
+    sig = r.signals[signal]
+  if sig.nBlocks > 0:
+    var
+      v, prev: TraceValue
+      state: seq[byte]
+      havePrev = false
+      blk = r.firstBlockAt(sig, fromTime)
+      done = false
+    while not done and blk < sig.firstBlock + sig.nBlocks:
+      let
+        b = r.blocks[blk]
+      if b.firstTime > toTime:
+        break
+      var
+        pos = b.offset.int
+        time = b.firstTime
+      # Each chunk starts from a value of all zeros.
+      state.setLen(0)
+      state.setLen(2 * (if sig.kind == skReal: 8 else: valueBytes(sig.size)))
+      for _ in 0 ..< b.count.int:
+        r.decode(sig, pos, time, state, v)
+        if v.time <= fromTime:
+          # Only the last of these is of interest.
+          prev = v
+          havePrev = true
+        elif v.time <= toTime:
+          if havePrev:
+            yield prev
+            havePrev = false
+          yield v
+        else:
+          done = true
+          break
+      inc blk
+    if havePrev:
+      yield prev
+
+proc formatValue*(sig: TraceSignal; v: TraceValue): string =
+  ## Format a value of `sig`: binary digits (with x and z) for vectors.
+  if sig.kind == skReal:
+    return $v.real
+  result = newString(sig.size)
+  for i in 0 ..< sig.size:
+    let
+      bit = sig.size - 1 - i
+      a = (v.aval[bit shr 5] shr (bit and 31)) and 1
+      b = (v.bval[bit shr 5] shr (bit and 31)) and 1
+    result[i] = "01zx"[(a or (b shl 1)).int]
+
+proc formatTime*(r: TraceReader; time: int64): string =
+  ## Format a time in units of the simulation precision, e.g. "1250 ps".
+  const
+    units = ["s", "ms", "us", "ns", "ps", "fs"]
+  let
+    unitIndex = (2 - r.precision) div 3
+    magnitude = [1'i64, 10, 100][r.precision + 3 * unitIndex]
+  return $(time * magnitude) & " " & units[unitIndex]
+
+proc signalsUnder*(r: TraceReader; scope: string): seq[int] =
+  ## Return the indices of the signals in the hierarchy below `scope`
+  ## (all of them if `scope` is empty).
+  for i, sig in r.signals:
+    if scope.len == 0 or sig.name.startsWith(scope & "."):
+      result.add(i)
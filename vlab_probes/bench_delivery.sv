@@ -0,0 +1,82 @@
+//-----------------------------------------------------------------------------
+// File:        bench_delivery.sv
+// Description: Benchmark of the two vlab_probes delivery modes
+//-----------------------------------------------------------------------------
+// Lots of probed signals change in several delta cycles of every time
+// step.  With DELIVER_IMMEDIATE the notifier wakes SV up for each
+// round of changes; with DELIVER_PER_TIMESTEP it wakes SV up once per
+// time step.  Run both with "make bench", which times each run; the
+// number of wake-ups is printed at the end.
+//
+// Plusargs:
+//    +delivery=<0|1>  delivery mode (see signal_probe::delivery_e)
+//-----------------------------------------------------------------------------
+
+`timescale 1ns/1ps
+
+`ifndef BENCH_PROBES
+  `define BENCH_PROBES 4096
+`endif
+`ifndef BENCH_STEPS
+  `define BENCH_STEPS 20000
+`endif
+
+module bench;
+
+  import vlab_probes_pkg::signal_probe;
+  import vlab_probes_pkg::signal_probe_group;
+
+  localparam int N = `BENCH_PROBES;
+
+  event tick;
+
+  // Each counter changes twice per time step: once in the active
+  // region, and once more after an NBA.
+  generate
+    genvar i;
+    for (i=0; i<N; i++) begin: g
+      logic [7:0] c = 0;
+      always @tick begin
+        c = c + 1;
+        c <= c + 2;
+      end
+    end
+  endgenerate
+
+  initial begin
+    repeat (`BENCH_STEPS) #1 ->tick;
+  end
+
+  signal_probe_group group = new();
+  int delivery;
+  longint wakes, changes;
+
+  initial begin
+    string names[];
+    signal_probe probes[];
+    int keys[$];
+
+    if (!$value$plusargs("delivery=%d", delivery))
+      delivery = signal_probe::DELIVER_IMMEDIATE;
+    signal_probe::setDeliveryMode(signal_probe::delivery_e'(delivery));
+
+    names = new[N];
+    foreach (names[i])
+      names[i] = $sformatf("bench.g[%0d].c", i);
+    signal_probe::createMany(names, probes);
+    foreach (probes[i])
+      group.add(probes[i]);
+
+    forever begin
+      group.waitForAnyChange(keys);
+      wakes++;
+      changes += keys.size();
+    end
+  end
+
+  final begin
+    $display("delivery=%0d probes=%0d steps=%0d: notifications=%0d, group wake-ups=%0d, changes seen=%0d",
+             delivery, N, `BENCH_STEPS, signal_probe::getNotifyCount(), wakes, changes);
+  end
+
+endmodule
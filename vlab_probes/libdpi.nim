@@ -1,6 +1,7 @@
-import std/[strformat, strutils]
+import std/[algorithm, bitops, monotimes, strformat, tables]
 import svdpi, svvpi
-from ptr_math import `[]`
+import ../name_index
+import probe_export
 
 template dbg(str: typed) =
   when defined(debug):
@@ -11,28 +12,127 @@ template dbg(str: typed) =
 ## The following struct is used to hold information about a
 ## probed signal.  Various features of the signal are cached
 ## here, to avoid making repeated VPI accesses to discover this
-## information.  The structure sometimes appears on a linked list
-## of signals that need to be serviced (the changeList), and
-## struct members to support that linked list are also included.
+## information.
+##
+## All the hook records live in a single slab (`hooks` below), so
+## that creating 100k+ probes does not mean 100k+ separate heap
+## objects, and so that nothing on this path depends on the Nim GC.
+## The fields that are touched on every value-change (the signal
+## handle, its source, its size and the changeList flag) are kept
+## in separate arrays, struct-of-arrays style, indexed by the hook's
+## slot number.  The rest of the record is in `HookRecord`.
+##
+## Several hooks can watch the same physical signal: the same variable
+## probed twice, or a net probed at different levels of the hierarchy
+## through the ports it is connected to.  Value-change callbacks are
+## not placed on the hooks but on their *sources*, one per physical
+## signal, and a source's callback fans out to all of its enabled
+## hooks.  So the simulator only ever runs one callback per change,
+## however many probes look at the signal.
 type
-  HookRecord = ref object
-   changeList_link: HookRecord    ## linked list pointer - records awaiting processing
-   on_changeList: bool            ## true if we're on the list, false if not
-   check {.cursor.}: HookRecord   ## copy of self-pointer, for safety
-   obj: VpiHandle                 ## reference to the monitored signal
+  FilterMode = enum
+    ## Which value-changes on a signal are passed on to SV.
+    filterNone          ## every value-change
+    filterPosedge       ## a Verilog posedge on the LSB (0->1, 0->x/z, x/z->1)
+    filterNegedge       ## a Verilog negedge on the LSB (1->0, 1->x/z, x/z->0)
+    filterValueEquals   ## the masked value becomes equal to the filter value
+    filterAnyBitInMask  ## any of the bits in the mask changes
+
+  DeliveryMode = enum
+    ## When SV is told that the changeList needs service.
+    deliverImmediate    ## from the first value-change callback that finds the changeList empty
+    deliverPerTimestep  ## once, from a cbReadWriteSynch callback after the changes of the time step
+
+  HookRecord = object
    sv_key: cint                   ## unique key to help SV find this
-   cb: VpiHandle                  ## VPI value-change callback object
-   size: cint                     ## number of bits in the signal
    isSigned: bool                 ## is the signal signed?
    top_mask: cuint                ## word-mask for most significant 32 bits
    top_msb: cuint                 ## MSB position within that word
+   valueOffset: int               ## index of the signal's first word in `hooks.values`
+   valueValid: bool               ## true if the cached value is known to be current
+   historyDepth: int              ## number of entries in the history ring (0 = off)
+   historyHead: int               ## ring index where the next entry will be written
+   historyCount: int              ## number of valid entries in the ring
+   historyValues: seq[svLogicVecVal] ## ring of values, numWords words per entry
+   historyTimes: seq[int64]       ## ring of value-change times (vpiSimTime)
+   filterMode: FilterMode         ## which value-changes are passed on to SV
+   filterMask: seq[uint32]        ## bits of interest, for the masked filter modes
+   filterValue: seq[svLogicVecVal] ## value to compare against for filterValueEquals
+   callbacks: int64               ## value-change callbacks received (while instrumented)
+   pushes: int64                  ## times put on the changeList
+   notifications: int64           ## times delivered to SV
+   toggles: int64                 ## notifier toggles caused by this signal
+   pushedAt: int64                ## monotonic time (ns) it was last put on the changeList
+
+  HookSlab = object
+   obj: seq[VpiHandle]            ## reference to the monitored signal
+   src: seq[int32]                ## slot of the signal's source in `sources`
+   enabled: seq[bool]             ## true if value-change monitoring is enabled
+   size: seq[cint]                ## number of bits in the signal
+   on_changeList: seq[bool]       ## true if we're on the list, false if not
+   records: seq[HookRecord]       ## all the other, less frequently used, fields
+   values: seq[svLogicVecVal]     ## cached vector values of all the signals, back to back
+
+  SamplerTable = object
+   period: seq[int64]             ## sampling period, in simulation time units
+   members: seq[seq[int32]]       ## slots of the hooks that are sampled
+   last: seq[seq[svLogicVecVal]]  ## previous sample of all the members, back to back
+   cb: seq[VpiHandle]             ## pending cbAfterDelay callback, nil if stopped
+
+  SourceTable = object
+   obj: seq[VpiHandle]            ## the physical signal that the callback is placed on
+   ownsObj: seq[bool]             ## true if `obj` must be released (not from the name index)
+   cb: seq[VpiHandle]             ## VPI value-change callback object, shared by the subscribers
+   collectsValue: seq[bool]       ## true if `cb` collects the new value and time
+   subscribers: seq[seq[int32]]   ## slots of all the hooks on this signal
+   byKey: Table[string, int32]    ## full name and size of the physical signal -> slot
+
+## SV refers to a hook by a 32-bit handle that packs its slot number
+## in the slab with the slab's generation number.  The generation is
+## bumped every time the slab is emptied (on simulation reset), so a
+## handle left over from before that can never alias a new hook.
+const
+  hookIndexBits = 22                                   ## up to 4M hooks
+  hookIndexMask = (1'u32 shl hookIndexBits) - 1
+  hookGenerationMask = (1'u32 shl (32 - hookIndexBits)) - 1
 
 var
-  # A single list of hook_records that have value changes yet to be handled
-  changeList: HookRecord
+  # All the hook records
+  hooks: HookSlab
+  # The physical signals under the hooks, and their callbacks
+  sources: SourceTable
+  # Groups of hooks that are sampled periodically
+  samplers: SamplerTable
+  # Generation number of the slab, never 0 so that 0 is never a valid handle
+  generation = 1'u32
+  # Slots of the hook_records that have value changes yet to be handled
+  changeList: seq[int32]
   # VPI handle to the single bit that is toggled to notify SV of pending
   # value-changes that require service
   notifier: VpiHandle
+  # VPI handle to the simulation reset callback
+  reset_callback: VpiHandle
+  # VPI handle to the simulation save callback
+  save_callback: VpiHandle
+  # VPI handles to the start and end of restart callbacks
+  restart_callbacks: array[2, VpiHandle]
+  # Probe table saved with the simulation, read back at the start of a restart
+  restartData: seq[byte]
+  # VPI handle to the end of simulation callback
+  end_callback: VpiHandle
+  # When SV is notified of pending value-changes
+  deliveryMode = deliverImmediate
+  # Value of the notifier bit, as last written by deliverPerTimestep
+  notifierState: bool
+  # VPI handle to the pending cbReadWriteSynch callback, if any
+  flush_callback: VpiHandle
+  # Number of times that the notifier has been toggled
+  notifyCount: int64
+  # Keep the per-signal activity counters and the latency histogram
+  instrumented: bool
+  # latencyHistogram[0] counts callback-to-notification delays under
+  # 1ns, and latencyHistogram[b] those in [2^(b-1), 2^b) ns
+  latencyHistogram: array[48, int64]
 
 
 ## Static (file-local) helper functions
@@ -56,25 +156,121 @@ proc stop_on_error(message: string) =
   report_error("Stopping.  Continue the run to see further diagnostics")
   vpi_control(vpiStop, 1)
 
-proc changeList_pop(): HookRecord =
+proc allocate_hook_record(obj: VpiHandle; size: cint): int =
+  ## Get and initialize a new slot in the hook slab, with room for
+  ## the cached value of a `size`-bit signal.  Return the slot number.
+  result = hooks.obj.len
+  hooks.obj.add(obj)
+  hooks.src.add(-1)
+  hooks.enabled.add(false)
+  hooks.size.add(size)
+  hooks.on_changeList.add(false)
+  hooks.records.add(HookRecord(valueOffset: hooks.values.len))
+  hooks.values.setLen(hooks.values.len + ((size + 31) shr 5))
+
+proc free_everything() =
+  ## Deallocate all memory structures owned by this VPI application,
+  ## and invalidate all the handles given out so far.
+  ## This will typically be done by the VPI simulation restart callback.
+  ## NOTE that the restart callback itself is NOT deallocated here,
+  ## because this function is probably called from within that callback.
+  for s in 0 ..< sources.obj.len:
+    if sources.cb[s] != nil:
+      discard vpi_remove_cb(sources.cb[s])
+    if sources.ownsObj[s]:
+      discard vpi_release_handle(sources.obj[s])
+  if flush_callback != nil:
+    discard vpi_remove_cb(flush_callback)
+    flush_callback = nil
+  # The sv_keys in an export would mean nothing after this.
+  stopExport()
+  # The other signal handles and the notifier handle all came from the
+  # name index, which releases them.
+  notifier = nil
+  clearNameIndex()
+  for p in 0 ..< samplers.cb.len:
+    if samplers.cb[p] != nil:
+      discard vpi_remove_cb(samplers.cb[p])
+  hooks = HookSlab()
+  sources = SourceTable()
+  samplers = SamplerTable()
+  changeList.setLen(0)
+  generation = (generation + 1) and hookGenerationMask
+  if generation == 0:
+    generation = 1
+
+proc hook_to_handle(h: int): cuint =
+  ## Make the handle that SV uses to refer to the hook in slot `h`.
+  ## Sources are referred to by handles of the same form, in the
+  ## user_data of their callbacks.
+  return (generation shl hookIndexBits) or h.uint32
+
+proc find_source(obj: VpiHandle; size: cint): int =
+  ## Return the slot of the source for the physical signal behind
+  ## `obj`, adding a new source if no other hook watches that signal.
+  ## A net is identified by its simulated net (vpiSimNet), which is the
+  ## same object for all the nets that are connected together through
+  ## ports; anything else is identified by itself.  The full name and
+  ## size of that object give a cheap key, and the simulator confirms
+  ## that it really is the same object.
+  var
+    phys = obj
+    owns = false
+  if vpi_get(vpiType, obj) == vpiNet:
+    let
+      simNet = vpi_handle(vpiSimNet, obj)
+    if simNet != nil:
+      if vpi_get(vpiSize, simNet) == size:
+        phys = simNet
+        owns = true
+      else:
+        discard vpi_release_handle(simNet)
+
+  let
+    key = &"{vpi_get_str(vpiFullName, phys)}/{size}"
+    s = sources.byKey.getOrDefault(key, -1)
+  if s >= 0 and vpi_compare_objects(sources.obj[s], phys) != 0:
+    if owns:
+      discard vpi_release_handle(phys)
+    return s
+
+  result = sources.obj.len
+  sources.obj.add(phys)
+  sources.ownsObj.add(owns)
+  sources.cb.add(nil)
+  sources.collectsValue.add(false)
+  sources.subscribers.add(@[])
+  if s < 0:
+    sources.byKey[key] = result.int32
+
+proc changeList_pop(): int =
   ## Get and remove the first (newest) entry from the
   ## list of signals with unserviced value changes.
-  ## Return a reference to that entry.
+  ## Return the slot number of that entry, or -1 if the list is empty.
+  if changeList.len == 0:
+    return -1
   let
-    hook = changeList
-  if hook != nil:
-    changeList = hook.changeList_link
-    hook.on_changeList = false
-  return hook
+    h = changeList.pop()
+  hooks.on_changeList[h] = false
+  if instrumented:
+    template rec: untyped = hooks.records[h]
+    let
+      delay = getMonoTime().ticks - rec.pushedAt
+      bucket = if delay <= 0: 0 else: min(fastLog2(delay) + 1, latencyHistogram.high)
+    inc latencyHistogram[bucket]
+    inc rec.notifications
+  return h
 
-proc changeList_pushIfNeeded(hook: HookRecord) =
+proc changeList_pushIfNeeded(h: int) =
   ## Add a signal to the list of unserviced value changes.
   ## But if the signal is already on that list, don't
   ## try to add it again.
-  if not hook.on_changeList:
-    hook.on_changeList = true
-    hook.changeList_link = changeList
-    changeList = hook
+  if not hooks.on_changeList[h]:
+    hooks.on_changeList[h] = true
+    changeList.add(h.int32)
+    if instrumented:
+      inc hooks.records[h].pushes
+      hooks.records[h].pushedAt = getMonoTime().ticks
 
 proc isVerilogType(vpi_type: cint): bool =
   ## Check to see whether a vpiType value represents
@@ -87,16 +283,225 @@ proc isVerilogType(vpi_type: cint): bool =
                        vpiBitSelect, vpiBitVar, vpiEnumVar, vpiIntVar,
                        vpiLongIntVar, vpiShortIntVar, vpiIntegerVar, vpiByteVar }
 
-proc chandle_to_hook(hnd: pointer): HookRecord =
-  ## Given a handle value obtained from an untrusted source,
-  ## cast it to a HookRecord and do some sanity checks.
+proc numWords(h: int): int =
+  ## Number of 32-bit aval/bval words needed to hold the signal's value.
+  return (hooks.size[h] + 31) shr 5
+
+template cachedWord(h: int; w: int): untyped =
+  ## Word `w` of the cached value of the signal in slot `h`.
+  hooks.values[hooks.records[h].valueOffset + w]
+
+proc storeValue(h: int; vecPtr: pointer) =
+  ## Copy a vector value obtained from VPI into the signal's value cache.
+  copyMem(addr hooks.values[hooks.records[h].valueOffset], vecPtr, h.numWords * sizeof(svLogicVecVal))
+
+proc refreshValue(h: int) =
+  ## Make sure that the cached vector value of the signal is current.
+  ## While value-change callbacks are enabled on the signal, every
+  ## change clears `valueValid`, so the cache can be reused for any
+  ## number of reads (of any chunk) until the signal next changes.
+  ## Without the callback there is no way to tell whether the value
+  ## moved on since the last read, so the simulator is always asked.
+  if hooks.records[h].valueValid and hooks.enabled[h]:
+    return
+  var
+    value_s = s_vpi_value(format: vpiVectorVal)
+  vpi_get_value(hooks.obj[h], addr value_s)
+  h.storeValue(value_s.value.vector)
+  hooks.records[h].valueValid = hooks.enabled[h]
+
+proc extendTopWord(h: int; word: var svLogicVecVal) =
+  ## Mask off the unused bits of the most significant word of a
+  ## signal that does not completely fill it, then zero-extend it if
+  ## the signal is unsigned, or sign-extend it if it is signed.
+  template rec: untyped = hooks.records[h]
+  word.aval = word.aval and rec.top_mask
+  word.bval = word.bval and rec.top_mask
+  if rec.isSigned:
+    # aval/bval encoding: 00=0, 10=1, 11=X, 01=Z
+    #                                  ^     ^
+    # There is no point to sign-extend if the MSB bit is X or Z i.e. if MSB bit's bval is 1.
+    # We need to sign-extend only if the MSB bit is negative i.e. == 1 (aval/bval = 10).
+    if (word.bval and rec.top_msb) == 0 and (word.aval and rec.top_msb) != 0:
+      word.aval = word.aval or (not rec.top_mask)
+
+proc recordHistory(h: int; vecPtr: pointer; time: int64) =
+  ## Copy a value-change into the next slot of the signal's history
+  ## ring, overwriting the oldest entry once the ring is full.
+  template rec: untyped = hooks.records[h]
   let
-    hook = cast[HookRecord](hnd)
-  if hook != nil and hook.check == hook:
-    return hook
+    nWords = h.numWords
+  copyMem(addr rec.historyValues[rec.historyHead * nWords], vecPtr, nWords * sizeof(svLogicVecVal))
+  rec.historyTimes[rec.historyHead] = time
+  rec.historyHead = (rec.historyHead + 1) mod rec.historyDepth
+  if rec.historyCount < rec.historyDepth:
+    inc rec.historyCount
+
+proc historySlot(h: int; index: int): int =
+  ## Ring index of the `index`'th most recent history entry; index 0
+  ## is the most recent value-change.
+  template rec: untyped = hooks.records[h]
+  return (rec.historyHead - 1 - index + rec.historyDepth) mod rec.historyDepth
+
+proc needsValue(h: int): bool =
+  ## True if the value-change callback of the signal must collect its
+  ## new value, for the history, for the filter or for the export.
+  template rec: untyped = hooks.records[h]
+  return rec.historyDepth > 0 or rec.filterMode != filterNone or exportRunning()
+
+proc lsbState(word: svLogicVecVal): int =
+  ## State of bit 0 of `word`: 0, 1, or 2 for X or Z.
+  if (word.bval and 1) != 0:
+    return 2
+  return int(word.aval and 1)
+
+proc passesFilter(h: int; newValue, oldValue: ptr UncheckedArray[svLogicVecVal]): bool =
+  ## Check a value-change from `oldValue` to `newValue` against the
+  ## signal's filter.
+  template rec: untyped = hooks.records[h]
+  case rec.filterMode
+  of filterNone:
+    return true
+  of filterPosedge, filterNegedge:
+    let
+      (was, now) = (lsbState(oldValue[0]), lsbState(newValue[0]))
+      (fromLevel, toLevel) = if rec.filterMode == filterPosedge: (0, 1) else: (1, 0)
+    return (was == fromLevel and now != fromLevel) or (was == 2 and now == toLevel)
+  of filterValueEquals:
+    var
+      wasEqual, isEqual = true
+    for w in 0 ..< h.numWords:
+      let
+        mask = rec.filterMask[w]
+        expected = rec.filterValue[w]
+        old = oldValue[w]
+      if ((newValue[w].aval xor expected.aval) and mask) != 0 or
+         ((newValue[w].bval xor expected.bval) and mask) != 0:
+        isEqual = false
+      if ((old.aval xor expected.aval) and mask) != 0 or
+         ((old.bval xor expected.bval) and mask) != 0:
+        wasEqual = false
+    return isEqual and not wasEqual
+  of filterAnyBitInMask:
+    for w in 0 ..< h.numWords:
+      let
+        old = oldValue[w]
+      if (((newValue[w].aval xor old.aval) or (newValue[w].bval xor old.bval)) and rec.filterMask[w]) != 0:
+        return true
+    return false
+
+proc handle_to_hook(hnd: cuint): int =
+  ## Given a handle value obtained from an untrusted source, check
+  ## that it refers to a hook of the current generation, and return
+  ## its slot number.  Return -1 if it does not.
+  let
+    h = int(hnd and hookIndexMask)
+  if (hnd shr hookIndexBits) == generation and h < hooks.obj.len and hooks.obj[h] != nil:
+    return h
+  else:
+    stop_on_error("Bad handle argument is not a valid created hook")
+    return -1
+
+
+proc report_stats(topN: int) =
+  ## Print the activity counters of the `topN` signals that have
+  ## received the most value-change callbacks, and the histogram of
+  ## the delays between a value-change callback and the delivery of
+  ## that change to SV.
+  const
+    prefix = "*I,VLAB_PROBES: "
+  var
+    order = newSeq[int](hooks.obj.len)
+    totals: array[4, int64]
+  for h in 0 ..< order.len:
+    order[h] = h
+    template rec: untyped = hooks.records[h]
+    totals[0] += rec.callbacks
+    totals[1] += rec.pushes
+    totals[2] += rec.notifications
+    totals[3] += rec.toggles
+  order.sort(proc (a, b: int): int = cmp(hooks.records[b].callbacks, hooks.records[a].callbacks))
+
+  vpiEcho &"{prefix}{hooks.obj.len} probes: {totals[0]} callbacks, {totals[1]} changeList pushes, " &
+          &"{totals[2]} notifications, {totals[3]} notifier toggles"
+  vpiEcho prefix & "   callbacks       pushes     notified    toggles  signal"
+  for h in order[0 ..< min(topN, order.len)]:
+    template rec: untyped = hooks.records[h]
+    if rec.callbacks == 0:
+      break
+    vpiEcho &"{prefix}{rec.callbacks:>12} {rec.pushes:>12} {rec.notifications:>12} {rec.toggles:>10}  " &
+            &"{vpi_get_str(vpiFullName, hooks.obj[h])}"
+
+  vpiEcho &"{prefix}callback-to-notification latency:"
+  for b, count in latencyHistogram:
+    if count > 0:
+      let
+        span = if b == 0: "< 1ns" else: &"{1'i64 shl (b-1)}ns .. {(1'i64 shl b) - 1}ns"
+      vpiEcho &"{prefix}  {span:>28}: {count}"
+
+
+## Static (file-local) helper functions related to simulator action callbacks
+
+# Defined with the save and restart helpers, further down.
+proc save_state()
+proc read_saved_state()
+proc restore_state()
+
+proc action_callback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## The callback function used to deal with simulator actions.
+  ## It handles cbStartOfReset, which is caused by an interactive
+  ## restart of the simulation back to time zero, the save and restart
+  ## callbacks, which carry the probe table across a save and restart
+  ## of the simulation, and cbEndOfSimulation, which finishes off any
+  ## export and dumps the activity counters, if they are kept.
+  case cbDataPtr.reason
+  of cbStartOfReset:
+    vpiEcho "\n\n*I,VLAB_PROBE: cbStartOfReset, deallocate all internal data\n\n"
+    free_everything()
+  of cbStartOfSave:
+    save_state()
+  of cbStartOfRestart:
+    read_saved_state()
+  of cbEndOfRestart:
+    restore_state()
+  of cbEndOfSimulation:
+    stopExport()
+    if instrumented:
+      report_stats(20)
   else:
-    stop_on_error("Bad chandle argument is not a valid created hook")
-    return nil
+    discard
+  return vpiCbSuccess
+
+proc register_action_callback(reason: cint): VpiHandle =
+  ## Register action_callback for the simulator action `reason`.
+  var
+    # Time and value structs should not be needed, but IUS requires them
+    time_s = s_vpi_time(`type`: vpiSuppressTime)
+    value_s = s_vpi_value(format: vpiSuppressVal)
+    cbData = s_cb_data(reason: reason,
+                       cb_rtn: action_callback,
+                       time: addr time_s,
+                       value: addr value_s)
+  return vpi_register_cb(addr cbData)
+
+proc setup_reset_callback() =
+  ## Set up reset/restart callbacks, removing any old callback if necessary.
+  ## The restart callbacks are the only ones that survive a save and
+  ## restart of the simulation, so they are set up only once.
+  if reset_callback != nil:
+    discard vpi_remove_cb(reset_callback)
+  if save_callback != nil:
+    discard vpi_remove_cb(save_callback)
+  reset_callback = register_action_callback(cbStartOfReset)
+  save_callback = register_action_callback(cbStartOfSave)
+  if restart_callbacks[0] == nil:
+    restart_callbacks = [register_action_callback(cbStartOfRestart),
+                         register_action_callback(cbEndOfRestart)]
+
+proc setup_end_callback() =
+  ## Set up the end of simulation callback, once.
+  if end_callback == nil:
+    end_callback = register_action_callback(cbEndOfSimulation)
 
 
 ## Static (file-local) helper functions related to value-change callbacks
@@ -116,16 +521,118 @@ proc toggle_notifier(): cint =
                            else:
                              vpi1
     discard vpi_put_value(notifier, addr value_s, nil, vpiNoDelay)
+    inc notifyCount
     return vpiCbSuccess
 
+proc read_notifier_state() =
+  ## Find out the current value of the notifier bit, so that
+  ## deliverPerTimestep can toggle it without reading it every time.
+  if notifier != nil:
+    var
+      value_s = s_vpi_value(format: vpiScalarVal)
+    vpi_get_value(notifier, addr value_s)
+    notifierState = value_s.value.scalar == vpi1
+
+proc flush_cb_handler(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## The cbReadWriteSynch callback used by deliverPerTimestep.  By the
+  ## time it runs, all the value-changes of the time step so far are on
+  ## the changeList, and SV is woken up just once to service all of
+  ## them.  The notifier value is kept here, so it is only written.
+  flush_callback = nil
+  if changeList.len == 0:
+    return vpiCbSuccess
+  if notifier == nil:
+    stop_on_error("Value-change callback but no active notifier bit")
+    return vpiCbFailure
+  notifierState = not notifierState
+  var
+    value_s = s_vpi_value(format: vpiScalarVal)
+  value_s.value.scalar = if notifierState: vpi1 else: vpi0
+  discard vpi_put_value(notifier, addr value_s, nil, vpiNoDelay)
+  inc notifyCount
+  return vpiCbSuccess
+
+proc schedule_flush() =
+  ## Arrange for flush_cb_handler to run at the end of the current
+  ## time step, unless it is already due to.
+  if flush_callback == nil:
+    var
+      time_s = s_vpi_time(`type`: vpiSimTime)
+      value_s = s_vpi_value(format: vpiSuppressVal)
+      cbData = s_cb_data(reason: cbReadWriteSynch,
+                         cb_rtn: flush_cb_handler,
+                         time: addr time_s,
+                         value: addr value_s)
+    flush_callback = vpi_register_cb(addr cbData)
+
+proc notify_sv(): cint =
+  ## Tell SV that the changeList, which was empty, needs service,
+  ## in the way selected by the delivery mode.
+  case deliveryMode
+  of deliverImmediate:
+    return toggle_notifier()
+  of deliverPerTimestep:
+    schedule_flush()
+    return vpiCbSuccess
+
+proc accept_value(h: int; vecPtr: pointer; oldValue: ptr UncheckedArray[svLogicVecVal]; time: int64): bool =
+  ## Take in a new value of the signal in slot `h`, which was
+  ## `oldValue` before: check the change against the filter, keep it in
+  ## the history ring and pass it on to the export, and keep the value
+  ## as the cached value.  Return false if the filter drops the change.
+  result = h.passesFilter(cast[ptr UncheckedArray[svLogicVecVal]](vecPtr), oldValue)
+  if hooks.records[h].historyDepth > 0:
+    h.recordHistory(vecPtr, time)
+  if result and exportRunning():
+    pushChange(hooks.records[h].sv_key, time, vecPtr, h.numWords)
+  h.storeValue(vecPtr)
+
+proc notify_if_first(require_notification: bool): cint =
+  ## Notify SV if the changeList was empty before the current callback
+  ## (`require_notification`), and is not empty any more.
+  if require_notification and changeList.len > 0:
+    if instrumented:
+      # The first signal on the changeList is the one that caused the
+      # notification.
+      inc hooks.records[changeList[0]].toggles
+    # Toggle the notifier bit, now or at the end of the time step.
+    return notify_sv()
+  else:
+    return vpiCbSuccess
+
+proc hook_changed(h: int; cbDataPtr: p_cb_data) =
+  ## Deal with a value-change on the signal of the enabled hook in
+  ## slot `h`: update its value cache and history, and put it on the
+  ## changeList unless its filter drops the change.
+  var
+    interesting = true
+  if instrumented:
+    inc hooks.records[h].callbacks
+  if h.needsValue:
+    # The callback was registered to collect the new value and the
+    # time.  The filter compares against the previous cached value.
+    interesting = h.accept_value(cbDataPtr.value.value.vector,
+                                 cast[ptr UncheckedArray[svLogicVecVal]](addr h.cachedWord(0)),
+                                 (cbDataPtr.time.high.int64 shl 32) or cbDataPtr.time.low.int64)
+    hooks.records[h].valueValid = true
+  else:
+    # Any cached copy of the signal's value is now stale.
+    hooks.records[h].valueValid = false
+  if interesting:
+    # Put this object on the changeList, if it isn't already.
+    changeList_pushIfNeeded(h)
+
 proc vc_callback(cbDataPtr: p_cb_data): cint {.cdecl.} =
   ## This is the function that is provided to the VPI as a
   ## value-change callback handler.  There is only one entry point.
-  ## Each callback's user_data field holds a pointer to the
-  ## corresponding signal's hook_record structure.
+  ## Each callback's user_data field holds the handle of the
+  ## corresponding physical signal's source, and the change is passed
+  ## on to every enabled hook on that signal.
   let
-    hook = chandle_to_hook(cast[pointer](cbDataPtr[].user_data))
-  if hook == nil:
+    hnd = cast[uint](cbDataPtr.user_data).cuint
+    s = int(hnd and hookIndexMask)
+  if (hnd shr hookIndexBits) != generation or s >= sources.obj.len:
+    stop_on_error("Value-change callback for a source that no longer exists")
     return vpiCbFailure
 
   # At any given time, the first signal that suffers a value-change
@@ -142,66 +649,420 @@ proc vc_callback(cbDataPtr: p_cb_data): cint {.cdecl.} =
   # We detect "first signal" by noting whether the changeList is
   # currently empty.
   let
-    require_notification = (changeList == nil)
-  # Put this object on the changeList, if it isn't already.
-  changeList_pushIfNeeded(hook)
-  if require_notification:
-    # Toggle the notifier bit.
-    return toggle_notifier()
-  else:
-    return vpiCbSuccess
+    require_notification = (changeList.len == 0)
+  for h in sources.subscribers[s]:
+    if hooks.enabled[h]:
+      hook_changed(h, cbDataPtr)
+  return notify_if_first(require_notification)
 
-proc enable_cb(hook: HookRecord) =
-  ## Sensitise to a signal by placing a value-change callback on it.
-  ## Set up the callback so that it does not collect the signal's
-  ## value or the callback time (reduces overhead).  Keep a copy
-  ## of the callback handle in the signal's hook record, to simplify
-  ## later removal of the callback.
-  if hook.cb == nil:
+proc sync_source_cb(s: int) =
+  ## Make the value-change callback of the source in slot `s` match
+  ## what its hooks need: no callback if none of them is enabled, and
+  ## otherwise a callback that collects the signal's value and the
+  ## callback time only if an enabled hook keeps a value history or
+  ## has a filter.  Not collecting them reduces overhead.  The callback
+  ## is re-registered if it has to start or stop collecting them.
+  var
+    wanted, wantValue = false
+  for h in sources.subscribers[s]:
+    if hooks.enabled[h]:
+      wanted = true
+      if h.needsValue:
+        wantValue = true
+  if sources.cb[s] != nil and (not wanted or sources.collectsValue[s] != wantValue):
+    discard vpi_remove_cb(sources.cb[s])
+    sources.cb[s] = nil
+  if wanted and sources.cb[s] == nil:
     var
+      time_s = s_vpi_time(`type`: vpiSimTime)
+      value_s = s_vpi_value(format: vpiVectorVal)
       cbData = s_cb_data(cb_rtn: vc_callback,
-                         obj: hook.obj,
-                         user_data: cast[cstring](hook),
+                         obj: sources.obj[s],
+                         user_data: cast[cstring](s.hook_to_handle.uint),
                          reason: cbValueChange)
-    hook.cb = vpi_register_cb(addr cbData)
+    if wantValue:
+      cbData.time = addr time_s
+      cbData.value = addr value_s
+    sources.cb[s] = vpi_register_cb(addr cbData)
+    sources.collectsValue[s] = wantValue
+
+proc enable_cb(h: int) =
+  ## Sensitise to a signal by enabling its hook on the value-change
+  ## callback of the signal's source, placing that callback first if
+  ## no other hook on the same signal is enabled.
+  if not hooks.enabled[h]:
+    if h.needsValue:
+      # The callback keeps the value cache up to date from now on, but
+      # it needs the current value to compare the first change against.
+      h.refreshValue()
+    hooks.enabled[h] = true
+    hooks.records[h].valueValid = h.needsValue
+    sync_source_cb(hooks.src[h])
+
+proc disable_cb(h: int) =
+  ## Disable value-change callbacks on a signal.  The source's
+  ## callback is removed completely once none of its hooks is enabled.
+  if hooks.enabled[h]:
+    hooks.enabled[h] = false
+    hooks.records[h].valueValid = false
+    sync_source_cb(hooks.src[h])
+
+## Static (file-local) helper functions related to periodic sampling
+
+proc take_sample(p: int; time: int64; deliver: bool) =
+  ## Read the current value of every signal of the sampler in slot `p`.
+  ## If `deliver` is true, the signals whose value differs from the
+  ## previous sample are passed on just like value-changes, filters and
+  ## all; otherwise the sample just becomes the baseline.
+  var
+    value_s = s_vpi_value(format: vpiVectorVal)
+    offset = 0
+  for h in samplers.members[p]:
+    let
+      nWords = h.numWords
+      lastPtr = addr samplers.last[p][offset]
+    vpi_get_value(hooks.obj[h], addr value_s)
+    if deliver and not equalMem(value_s.value.vector, lastPtr, nWords * sizeof(svLogicVecVal)):
+      if instrumented:
+        inc hooks.records[h].callbacks
+      if h.accept_value(value_s.value.vector, cast[ptr UncheckedArray[svLogicVecVal]](lastPtr), time):
+        changeList_pushIfNeeded(h)
+      # Unless value-change callbacks keep it current, the value cache
+      # is only a snapshot.
+      hooks.records[h].valueValid = hooks.records[h].valueValid and hooks.enabled[h]
+    copyMem(lastPtr, value_s.value.vector, nWords * sizeof(svLogicVecVal))
+    offset += nWords
+
+proc sample_callback(cbDataPtr: p_cb_data): cint {.cdecl.}
+
+proc schedule_sample(p: int) =
+  ## Have sample_callback run for the sampler in slot `p` one period
+  ## from now.
+  let
+    period = samplers.period[p]
+  var
+    time_s = s_vpi_time(`type`: vpiSimTime,
+                        high: uint32(period shr 32),
+                        low: uint32(period and 0xffff_ffff))
+    value_s = s_vpi_value(format: vpiSuppressVal)
+    cbData = s_cb_data(reason: cbAfterDelay,
+                       cb_rtn: sample_callback,
+                       time: addr time_s,
+                       value: addr value_s,
+                       user_data: cast[cstring](p.hook_to_handle.uint))
+  samplers.cb[p] = vpi_register_cb(addr cbData)
+
+proc sample_callback(cbDataPtr: p_cb_data): cint {.cdecl.} =
+  ## The cbAfterDelay callback of a sampler, whose handle is in the
+  ## callback's user_data: sample its signals, and schedule the next
+  ## sample.  A single callback does the work of all the value-change
+  ## callbacks on the signals between two samples.
+  let
+    hnd = cast[uint](cbDataPtr.user_data).cuint
+    p = int(hnd and hookIndexMask)
+  if (hnd shr hookIndexBits) != generation or p >= samplers.cb.len:
+    stop_on_error("Sampling callback for a sampler that no longer exists")
+    return vpiCbFailure
+  samplers.cb[p] = nil
+  let
+    require_notification = (changeList.len == 0)
+  take_sample(p, (cbDataPtr.time.high.int64 shl 32) or cbDataPtr.time.low.int64, deliver = true)
+  schedule_sample(p)
+  return notify_if_first(require_notification)
+
+proc start_sampler(p: int; period: int64) =
+  ## (Re)start the sampler in slot `p`, with the current values of its
+  ## signals as the baseline for the first sample.
+  if samplers.cb[p] != nil:
+    discard vpi_remove_cb(samplers.cb[p])
+  samplers.period[p] = period
+  take_sample(p, 0, deliver = false)
+  schedule_sample(p)
+
+proc add_sampler(members: seq[int32]; period: int64; disable = true): int =
+  ## Add a (stopped) sampler on the hooks in `members`, and return its
+  ## slot number.  Value-change callbacks on the members are disabled,
+  ## unless `disable` is false: the sampler replaces them.
+  var
+    nWords = 0
+  for h in members:
+    if disable:
+      disable_cb(h)
+    nWords += h.numWords
+  result = samplers.period.len
+  samplers.period.add(period)
+  samplers.members.add(members)
+  samplers.last.add(newSeq[svLogicVecVal](nWords))
+  samplers.cb.add(nil)
+
+
+proc init_hook(obj: VpiHandle; sv_key: cint): int =
+  ## Obtain a clean object record from the slab for the signal `obj`,
+  ## populate it, and return its slot number.
+  let
+    size = vpi_get(vpiSize, obj)
+    h = allocate_hook_record(obj, size)
+    s = find_source(obj, size)
+  hooks.src[h] = s.int32
+  sources.subscribers[s].add(h.int32)
+  template rec: untyped = hooks.records[h]
+  rec.isSigned = vpi_get(vpiSigned, obj) == 1
+  rec.sv_key = sv_key
+  rec.top_msb = cuint(1) shl ((size-1) mod 32)
+  rec.top_mask = cuint(2) * rec.top_msb - cuint(1)
+
+  dbg &"hook {h}: size = {size}, top_msb = {rec.top_msb:#x}, top_mask = {rec.top_mask:#x}"
+  return h
+
+
+## Static (file-local) helper functions related to save and restart
+
+## The probe table is saved with the simulation as a flat list of
+## 64-bit integers and length-prefixed strings: the generation number
+## and other global settings, the notifier's name, then, for each
+## hook in slot order, the signal's full name, its sv_key, whether it
+## is enabled, its history depth, and its filter, and finally, for each
+## sampler, its period, whether it is running, and its hooks.  On restart the hooks
+## are re-created in the same slots with the same generation number, so
+## the handles that SV restores with the rest of the simulation stay
+## valid and nothing has to be re-created from SV.
+const
+  saveMagic = 0x564c_5053_4156_4531'i64   # "VLPSAVE1"
+
+type
+  SavedState = object
+    ## Cursor for reading back `restartData`.
+    pos: int
+    ok: bool   # false once a read went past the end of the data
+
+proc putInt(data: var seq[byte]; x: int64) =
+  let
+    n = data.len
+  data.setLen(n + sizeof(x))
+  copyMem(addr data[n], unsafeAddr x, sizeof(x))
+
+proc putStr(data: var seq[byte]; str: string) =
+  data.putInt(str.len)
+  let
+    n = data.len
+  data.setLen(n + str.len)
+  if str.len > 0:
+    copyMem(addr data[n], unsafeAddr str[0], str.len)
+
+proc getInt(st: var SavedState): int64 =
+  if st.pos + sizeof(result) > restartData.len:
+    st.ok = false
+    return 0
+  copyMem(addr result, addr restartData[st.pos], sizeof(result))
+  st.pos += sizeof(result)
+
+proc getStr(st: var SavedState): string =
+  let
+    n = st.getInt().int
+  if n < 0 or st.pos + n > restartData.len:
+    st.ok = false
+    return ""
+  result = newString(n)
+  if n > 0:
+    copyMem(addr result[0], addr restartData[st.pos], n)
+  st.pos += n
+
+proc fullNameOf(obj: VpiHandle): string =
+  if obj == nil:
+    return ""
+  return $vpi_get_str(vpiFullName, obj)
+
+proc save_state() =
+  ## Save the probe table with the simulation (cbStartOfSave).
+  var
+    data: seq[byte]
+  data.putInt(saveMagic)
+  data.putInt(generation.int64)
+  data.putInt(ord(deliveryMode))
+  data.putInt(instrumented.int64)
+  data.putStr(fullNameOf(notifier))
+  data.putInt(hooks.obj.len)
+  for h in 0 ..< hooks.obj.len:
+    template rec: untyped = hooks.records[h]
+    data.putStr(fullNameOf(hooks.obj[h]))
+    data.putInt(rec.sv_key)
+    data.putInt(hooks.enabled[h].int64)
+    data.putInt(rec.historyDepth)
+    data.putInt(ord(rec.filterMode))
+    data.putInt(rec.filterMask.len)
+    for w in 0 ..< rec.filterMask.len:
+      data.putInt(rec.filterMask[w].int64)
+      data.putInt(rec.filterValue[w].aval.int64)
+      data.putInt(rec.filterValue[w].bval.int64)
+  data.putInt(samplers.period.len)
+  for p in 0 ..< samplers.period.len:
+    data.putInt(samplers.period[p])
+    data.putInt(int64(samplers.cb[p] != nil))
+    data.putInt(samplers.members[p].len)
+    for h in samplers.members[p]:
+      data.putInt(h)
+
+  let
+    id = vpi_get(vpiSaveRestartID, nil)
+  var
+    size = data.len.int64
+  discard vpi_put_data(id, cast[cstring](addr size), sizeof(size).cint)
+  discard vpi_put_data(id, cast[cstring](addr data[0]), data.len.cint)
+  vpiEcho &"*I,VLAB_PROBES: saved {hooks.obj.len} probes and {samplers.period.len} samplers with the simulation"
+
+proc read_saved_state() =
+  ## Read back the saved probe table (cbStartOfRestart).  Nothing else
+  ## can be done until the restart is complete.
+  let
+    id = vpi_get(vpiSaveRestartID, nil)
+  var
+    size: int64
+  restartData.setLen(0)
+  if vpi_get_data(id, cast[cstring](addr size), sizeof(size).cint) == sizeof(size) and size > 0:
+    restartData.setLen(size.int)
+    if vpi_get_data(id, cast[cstring](addr restartData[0]), size.cint) != size:
+      restartData.setLen(0)
+
+proc restore_state() =
+  ## Re-create the saved probe table (cbEndOfRestart).  All the names
+  ## are looked up first, through the name index, and every source's
+  ## callback is then registered once, rather than enabling one hook
+  ## at a time.
+  var
+    st = SavedState(ok: true)
+  if restartData.len == 0 or st.getInt() != saveMagic:
+    return
+
+  # No VPI handle or callback from before the restart is valid any
+  # more (apart from the restart callbacks), so just forget them.
+  stopExport()
+  hooks = HookSlab()
+  sources = SourceTable()
+  samplers = SamplerTable()
+  changeList.setLen(0)
+  notifier = nil
+  flush_callback = nil
+  reset_callback = nil
+  save_callback = nil
+  end_callback = nil
+  clearNameIndex(release = false)
+
+  generation = st.getInt().uint32 and hookGenerationMask
+  let
+    mode = st.getInt()
+  deliveryMode = if mode == ord(deliverPerTimestep): deliverPerTimestep else: deliverImmediate
+  instrumented = st.getInt() != 0
+  let
+    notifierName = st.getStr()
+    n = st.getInt()
+  var
+    restored, missing = 0
+  for i in 0 ..< n:
+    let
+      name = st.getStr()
+      sv_key = st.getInt().cint
+      enabled = st.getInt() != 0
+      depth = st.getInt().int
+      filter = st.getInt()
+      nMask = st.getInt().int
+    var
+      mask = newSeq[uint32](max(nMask, 0))
+      value = newSeq[svLogicVecVal](max(nMask, 0))
+    for w in 0 ..< nMask:
+      mask[w] = st.getInt().uint32
+      value[w].aval = st.getInt().uint32
+      value[w].bval = st.getInt().uint32
+    if not st.ok:
+      report_error("restart: the saved probe table is truncated")
+      break
+
+    let
+      obj = if name.len > 0: lookupName(name) else: nil
+    if obj == nil or not isVerilogType(vpi_get(vpiType, obj)):
+      # Keep the slot, so that all the other hooks keep their handles;
+      # handle_to_hook rejects the handle of this one.
+      discard allocate_hook_record(nil, 1)
+      if name.len > 0:
+        vpiEcho &"*W,VLAB_PROBES: restart: could not locate probed signal \"{name}\""
+        inc missing
+      continue
+
+    let
+      h = init_hook(obj, sv_key)
+    template rec: untyped = hooks.records[h]
+    if depth > 0:
+      rec.historyDepth = depth
+      rec.historyValues = newSeq[svLogicVecVal](depth * h.numWords)
+      rec.historyTimes = newSeq[int64](depth)
+    if filter > 0 and filter <= ord(FilterMode.high) and nMask == h.numWords:
+      rec.filterMode = FilterMode(filter)
+      rec.filterMask = mask
+      rec.filterValue = value
+    if enabled:
+      if h.needsValue:
+        h.refreshValue()
+      hooks.enabled[h] = true
+      rec.valueValid = h.needsValue
+    inc restored
+
+  for s in 0 ..< sources.obj.len:
+    sync_source_cb(s)
+
+  # The samplers keep their slots too, without any member that could
+  # not be found.
+  let
+    nSamplers = if st.ok: st.getInt().int else: 0
+  for p in 0 ..< nSamplers:
+    let
+      period = st.getInt()
+      running = st.getInt() != 0
+      nMembers = st.getInt()
+    var
+      members: seq[int32]
+    for i in 0 ..< nMembers:
+      let
+        h = st.getInt()
+      if h >= 0 and h < hooks.obj.len and hooks.obj[h] != nil:
+        members.add(h.int32)
+    if not st.ok:
+      report_error("restart: the saved sampler table is truncated")
+      break
+    discard add_sampler(members, period, disable = false)
+    if running:
+      start_sampler(p, period)
+
+  if notifierName.len > 0:
+    notifier = lookupName(notifierName)
+    read_notifier_state()
+  setup_reset_callback()
+  if instrumented:
+    setup_end_callback()
+  restartData = @[]
+  vpiEcho &"*I,VLAB_PROBES: restored {restored} probes after restart ({missing} not found)"
 
-proc disable_cb(hook: HookRecord) =
-  ## Disable value-change callbacks on a signal by removing
-  ## its value-change callback completely.
-  if hook.cb != nil:
-    discard vpi_remove_cb(hook.cb)
-    hook.cb = nil
 
 ## Proc signatures of functions/tasks exported from SystemVerilog via DPI-C
 
 proc vlab_probes_vcNotify(sv_key: cint) {.importc.}
   ## vlab_probes_processChangeList() calls this DPI export function
   ## once for each probed signal that has a pending value-change event.
-  ## It uses a unique int key, rather than the signal's vpi_handle
-  ## reference, to work around a tool limitation (no associative array
-  ## indexed by chandle).
+  ## It uses a unique int key, rather than the signal's handle, so
+  ## that SV can find the probe object by indexing an array.
 
 ## Procs for DPI-C import in SystemVerilog
 
-proc vlab_probes_create(name: cstring; sv_key: cint): pointer {.exportc, dynlib.} =
-  ## Create an access hook on the signal whose absolute pathname is `name`.
-  ## Use `sv_key` as the key shared between SV and C that will be used as
-  ## the unique identifier for the created probe object.
-  ## This function returns a pointer to a hook_record structure (see
-  ## below), which is returned from C as void* and passed to SV as
-  ## a "chandle".  It should be saved for use in future operations
-  ## on this signal.  In practice the SV code will do this by maintaining
-  ## an array of chandle indexed by their unique sv_key.
-  ## An access hook freshly created by this function has no properties,
-  ## i.e. it does nothing.  To make the access hook useful, it must be
-  ## enabled by a suitable call to vlab_probes_setVcEnable (see below).
+proc create_hook(name: cstring; sv_key: cint): cuint =
+  ## Create an access hook on the signal whose absolute pathname is
+  ## `name`, with key `sv_key`, and return its handle (0 on failure).
+  ## This is the common part of vlab_probes_create and
+  ## vlab_probes_createMany.
   let
-    obj = vpi_handle_by_name(name, nil)    # Locate the chosen object
+    obj = lookupName($name)    # Locate the chosen object
 
-  # If there was a problem, return nil to report it.
+  # If there was a problem, return 0 to report it.
   if obj == nil:
     vpiEcho &"*W,VLAB_PROBES: create(\"{name}\") could not locate requested signal"
-    return nil
+    return 0
   # Check the object is indeed a vector variable or net; error if not.
   let
     objType = vpi_get(vpiType, obj)
@@ -209,54 +1070,114 @@ proc vlab_probes_create(name: cstring; sv_key: cint): pointer {.exportc, dynlib.
   if not isVerilogType(objType):
     vpiEcho &"Unable to create probe on '{name}' with key {sv_key}, type={objType}"
     vpiEcho &"*W,VLAB_PROBES: create(\"{name}\"): object is not a variable or net of integral type"
-    return nil
-
-  let
-    hook = HookRecord(on_changeList: false,
-                      obj: obj,
-                      isSigned: vpi_get(vpiSigned, obj) == 1,
-                      size: vpi_get(vpiSize, obj),
-                      sv_key: sv_key)
-  # Do not garbage-collect these hooks, because we need to retain all
-  # the hooks for all the probe points for the whole simulation.
-  GC_ref(hook)
-  hook.top_msb = cuint(1) shl ((hook.size-1) mod 32)
-  hook.top_mask = cuint(2) * hook.top_msb - cuint(1)
-  hook.check = hook
-
-  dbg "hook addr = " & $cast[int](hook).toHex()
-  dbg &"hook: size = {hook.size}, top_msb = {hook.top_msb:#x}, top_mask = {hook.top_mask:#x}"
-  return cast[pointer](hook)
-
-proc vlab_probes_setVcEnable(hnd: pointer; enable: cint) {.exportc, dynlib.} =
+    return 0
+  if hooks.obj.len > hookIndexMask.int:
+    report_error(&"create(\"{name}\"): too many probes")
+    return 0
+  return init_hook(obj, sv_key).hook_to_handle
+
+proc vlab_probes_create(name: cstring; sv_key: cint): cuint {.exportc, dynlib.} =
+  ## Create an access hook on the signal whose absolute pathname is `name`.
+  ## Use `sv_key` as the key shared between SV and C that will be used as
+  ## the unique identifier for the created probe object.
+  ## This function returns a handle to the new hook record, a 32-bit
+  ## value that SV stores as an "int unsigned".  It should be saved for
+  ## use in future operations on this signal.  In practice the SV code
+  ## will do this by maintaining an array of handles indexed by their
+  ## unique sv_key.  A handle of 0 means that the hook could not be
+  ## created.
+  ## An access hook freshly created by this function has no properties,
+  ## i.e. it does nothing.  To make the access hook useful, it must be
+  ## enabled by a suitable call to vlab_probes_setVcEnable (see below).
+  return create_hook(name, sv_key)
+
+proc vlab_probes_createMany(names: svOpenArrayHandle; first_key: cint;
+                            handles, sizes, signs: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Bulk version of vlab_probes_create, so that bringing up a large
+  ## number of probes does not cost a DPI round trip for every one of
+  ## them, and for each of their static properties.  Create an access
+  ## hook on the signal named by each element of the open string array
+  ## `names`, using keys `first_key`, `first_key`+1, and so on.  The
+  ## handle of each new hook (0 if it could not be created), the size
+  ## of its signal and its signedness (0 or 1) are written to the
+  ## corresponding elements of `handles`, `sizes` and `signs`, which
+  ## must be at least as big as `names`.
+  ## Returns the number of hooks successfully created.
+  let
+    n = svSize(names, 1)
+    namesLow = svLow(names, 1)
+    handlesLow = svLow(handles, 1)
+    sizesLow = svLow(sizes, 1)
+    signsLow = svLow(signs, 1)
+  if svSize(handles, 1) < n or svSize(sizes, 1) < n or svSize(signs, 1) < n:
+    report_error("vlab_probes_createMany: output arrays are smaller than the array of names")
+    return 0
+
+  var
+    created: cint
+  for i in 0.cint ..< n:
+    let
+      name = cast[ptr cstring](svGetArrElemPtr1(names, namesLow + i))[]
+      hnd = create_hook(name, first_key + i)
+      handlePtr = cast[ptr cuint](svGetArrElemPtr1(handles, handlesLow + i))
+      sizePtr = cast[ptr cint](svGetArrElemPtr1(sizes, sizesLow + i))
+      signPtr = cast[ptr cint](svGetArrElemPtr1(signs, signsLow + i))
+    handlePtr[] = hnd
+    if hnd == 0:
+      sizePtr[] = 0
+      signPtr[] = 0
+    else:
+      let
+        h = int(hnd and hookIndexMask)
+      sizePtr[] = hooks.size[h]
+      signPtr[] = hooks.records[h].isSigned.cint
+      inc created
+  return created
+
+proc vlab_probes_setVcEnable(hnd: cuint; enable: cint) {.exportc, dynlib.} =
   ## Enable or disable value-changed callback on the signal referenced
-  ## by HookRecord `hnd`.  If `enable` is true (non-zero), value-change
+  ## by handle `hnd`.  If `enable` is true (non-zero), value-change
   ## monitoring is enabled for the signal.  If `enable` is false (zero),
   ## it is disabled.  If monitoring is already enabled and this function
   ## is called with `enable` true, the function has no effect.  Similarly,
   ## if monitoring is disabled and the function is called with `enable`
   ## false, it has no effect.
   let
-    hook = chandle_to_hook(hnd)
-  if hook == nil:
+    h = handle_to_hook(hnd)
+  if h < 0:
     return
   if enable == 1:
-    enable_cb(hook)
+    enable_cb(h)
   else:
-    disable_cb(hook)
+    disable_cb(h)
+
+proc vlab_probes_setVcEnableMany(handles: svOpenArrayHandle; enable: cint) {.exportc, dynlib.} =
+  ## Enable or disable value-changed callbacks, as vlab_probes_setVcEnable
+  ## does, on each of the signals referenced by the open array of
+  ## handles `handles`, in a single DPI call.
+  let
+    arrLow = svLow(handles, 1)
+  for i in 0.cint ..< svSize(handles, 1):
+    let
+      h = handle_to_hook(cast[ptr cuint](svGetArrElemPtr1(handles, arrLow + i))[])
+    if h < 0:
+      continue
+    if enable == 1:
+      enable_cb(h)
+    else:
+      disable_cb(h)
 
-proc vlab_probes_getVcEnable(hnd: pointer): cint {.exportc, dynlib.} =
+proc vlab_probes_getVcEnable(hnd: cuint): cint {.exportc, dynlib.} =
   ## Find the current enabled/disabled state of value-change callback
   ## on the signal accessed by the hook record referenced by `hnd`.
   ## Returns 0 (disabled) or 1 (enabled).
   let
-    hook = chandle_to_hook(hnd)
-  if hook == nil:
+    h = handle_to_hook(hnd)
+  if h < 0:
     return 0
-  if hook[].cb != nil:
-    return 1
+  return hooks.enabled[h].cint
 
-proc vlab_probes_getValue32(hnd: pointer; resultPtr: ptr svLogicVecVal; chunk: cint): cint {.exportc, dynlib.} =
+proc vlab_probes_getValue32(hnd: cuint; resultPtr: ptr svLogicVecVal; chunk: cint): cint {.exportc, dynlib.} =
   ## Get the current value of the signal referenced by `hnd`.
   ## The result is placed into the vector pointed by `resultPtr`,
   ## which must be a 32-bit logic or equivalent type.  `chunk`
@@ -274,10 +1195,10 @@ proc vlab_probes_getValue32(hnd: pointer; resultPtr: ptr svLogicVecVal; chunk: c
   var
     chunk = chunk
   let
-    hook = chandle_to_hook(hnd)
+    h = handle_to_hook(hnd)
     chunk_lsb = chunk * 32
 
-  if hook == nil:
+  if h < 0:
     stop_on_error("vlab_probes_getValue32: bad handle")
     return QuitFailure
 
@@ -285,57 +1206,85 @@ proc vlab_probes_getValue32(hnd: pointer; resultPtr: ptr svLogicVecVal; chunk: c
     report_error("vlab_probes_getValue32: negative chunk index")
     return QuitFailure
 
-  if chunk_lsb >= hook.size:
-    chunk = (hook.size - 1) shr 5 # div by 32
+  let
+    size = hooks.size[h]
+  if chunk_lsb >= size:
+    chunk = (size - 1) shr 5 # div by 32
 
-  # Get the whole vector value from VPI
-  var
-    value_s = s_vpi_value(format: vpiVectorVal)
-  vpi_get_value(hook.obj, addr value_s)
+  # Get the whole vector value, from VPI or from the cache.
+  refreshValue(h)
 
   # Copy the relevant aval/bval bits into the output argument.
-  let
-    vecPtr = value_s.value.vector # type ptr t_vpi_vecval
-  dbg &"size {hook.size}, chunk {chunk}: vector[0]: aval = {vecPtr[].aval:#x}, bval = {vecPtr[].aval:#x}"
-  resultPtr[] = cast[svLogicVecVal](vecPtr[chunk])
+  dbg &"size {size}, chunk {chunk}: vector[0]: aval = {h.cachedWord(0).aval:#x}, bval = {h.cachedWord(0).bval:#x}"
+  resultPtr[] = h.cachedWord(chunk)
 
   # Perform sign extension if appropriate.
-  if (chunk_lsb + 32) > hook.size:
+  if (chunk_lsb + 32) > size:
     # We're working on the most significant word, and it is not full.
-    dbg &"size {hook.size}: result before: aval = {resultPtr[].aval:#x}, bval = {resultPtr[].aval:#x}"
-    resultPtr[].aval = resultPtr[].aval and hook.top_mask
-    resultPtr[].bval = resultPtr[].bval and hook.top_mask
-    if hook.isSigned:
+    dbg &"size {size}: result before: aval = {resultPtr[].aval:#x}, bval = {resultPtr[].bval:#x}"
+    h.extendTopWord(resultPtr[])
+    dbg &"size {size}: result after: aval = {resultPtr[].aval:#x}, bval = {resultPtr[].bval:#x}"
+  return QuitSuccess
+
+proc vlab_probes_getValue(hnd: cuint; value: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Get the full value of the signal referenced by `hnd` in one call.
+  ## `value` is an open array of 32-bit logic words: element 0 receives
+  ## the least significant 32 bits, element 1 gets bits [63:32], and so
+  ## on.  The array must have at least getSize()/32 (rounded up)
+  ## elements; any elements beyond the width of the signal are filled
+  ## with its zero- or sign-extension, just like vlab_probes_getValue32.
+  ## Returns 0 if success, 1 if failure (bad handle, array too small).
+  let
+    h = handle_to_hook(hnd)
+  if h < 0:
+    stop_on_error("vlab_probes_getValue: bad handle")
+    return QuitFailure
+
+  let
+    nWords = h.numWords
+    arrLow = svLow(value, 1)
+    arrSize = svSize(value, 1)
+  if arrSize < nWords:
+    report_error(&"vlab_probes_getValue: array of {arrSize} words cannot hold {hooks.size[h]} bits")
+    return QuitFailure
+
+  refreshValue(h)
+  for i in 0 ..< arrSize:
+    let
+      resultPtr = cast[ptr svLogicVecVal](svGetArrElemPtr1(value, arrLow + i.cint))
+    if i < nWords:
+      resultPtr[] = h.cachedWord(i)
+      if i == nWords - 1:
+        h.extendTopWord(resultPtr[])
+    else:
+      # Words beyond the signal are its zero-extension, or its
+      # sign-extension if it is signed and its MSB is 1 (not X/Z).
       let
-        msbBval = resultPtr[].bval and hook.top_msb
-      # aval/bval encoding: 00=0, 10=1, 11=X, 01=Z
-      #                                  ^     ^
-      # There is no point to sign-extend if the MSB bit is X or Z i.e. if MSB bit's bval is 1.
-      if msbBval == 0:
-        let
-          msbAval = resultPtr[].aval and hook.top_msb
-        # We need to sign-extend only if the MSB bit is negative i.e. == 1 (aval/bval = 10)
-        if msbAval == 1:
-          resultPtr[].aval = resultPtr[].aval or (not hook.top_mask)
-    dbg &"size {hook.size}: result after: aval = {resultPtr[].aval:#x}, bval = {resultPtr[].aval:#x}"
+        topPtr = cast[ptr svLogicVecVal](svGetArrElemPtr1(value, arrLow + cint(nWords - 1)))
+        negative = hooks.records[h].isSigned and
+                   (topPtr[].bval and 0x8000_0000'u32) == 0 and
+                   (topPtr[].aval and 0x8000_0000'u32) != 0
+        signBits = if negative: not 0'u32 else: 0'u32
+      resultPtr[].aval = signBits
+      resultPtr[].bval = 0
   return QuitSuccess
 
-proc vlab_probes_getSize(hnd: pointer): cint {.exportc, dynlib.} =
+proc vlab_probes_getSize(hnd: cuint): cint {.exportc, dynlib.} =
   ## Get the number of bits in the signal referenced by `hnd`.
   let
-    hook = chandle_to_hook(hnd)
-  if hook == nil:
-    return 0 # return size as 0 if hook is nil
-  return hook.size
+    h = handle_to_hook(hnd)
+  if h < 0:
+    return 0 # return size as 0 if the handle is bad
+  return hooks.size[h]
 
-proc vlab_probes_getSigned(hnd: pointer): cint {.exportc, dynlib.} =
+proc vlab_probes_getSigned(hnd: cuint): cint {.exportc, dynlib.} =
   ## Get a flag indicating whether the signal referenced by `hnd`
   ## is signed (0=unsigned, 1=signed).
   let
-    hook = chandle_to_hook(hnd)
-  if hook == nil:
-    return 0 # return unsigned by default if hook is nil
-  return hook.isSigned.cint
+    h = handle_to_hook(hnd)
+  if h < 0:
+    return 0 # return unsigned by default if the handle is bad
+  return hooks.records[h].isSigned.cint
 
 proc vlab_probes_specifyNotifier(fullname: cstring): cint {.exportc, dynlib.} =
   ## Here's how we get the value change information back in to SV.
@@ -343,7 +1292,7 @@ proc vlab_probes_specifyNotifier(fullname: cstring): cint {.exportc, dynlib.} =
   ## That signal will be toggled by the VPI whenever it requires
   ## attention from SV because one of the probed signals has changed.
   let
-    obj = vpi_handle_by_name(fullname, nil) # Locate the chosen notifier signal
+    obj = lookupName($fullname) # Locate the chosen notifier signal
 
   # If there was a problem, return nil to report it.
   if obj == nil:
@@ -356,14 +1305,405 @@ proc vlab_probes_specifyNotifier(fullname: cstring): cint {.exportc, dynlib.} =
     return QuitFailure
 
   notifier = obj
+  read_notifier_state()
+  setup_reset_callback()
+  return QuitSuccess
+
+proc vlab_probes_setDeliveryMode(mode: cint): cint {.exportc, dynlib.} =
+  ## Choose when SV is notified of pending value-changes:
+  ##   0: as soon as the first of them happens (the default).  SV may
+  ##      be woken several times in a time step, and every wake-up
+  ##      costs a read and a write of the notifier.
+  ##   1: once per time step, from a cbReadWriteSynch callback that is
+  ##      registered when the changeList becomes non-empty.  Only the
+  ##      notifier is written; its value is kept on the Nim side.
+  ## The mode can be changed at any time.
+  ## Returns 0 if success, 1 if failure (bad mode).
+  if mode < ord(DeliveryMode.low) or mode > ord(DeliveryMode.high):
+    report_error(&"vlab_probes_setDeliveryMode: bad delivery mode {mode}")
+    return QuitFailure
+  deliveryMode = DeliveryMode(mode)
+  read_notifier_state()
   return QuitSuccess
 
+proc vlab_probes_getNotifyCount(): int64 {.exportc, dynlib.} =
+  ## Get the number of times that SV has been notified (i.e. woken
+  ## up) to service pending value-changes, in either delivery mode.
+  return notifyCount
+
 proc vlab_probes_processChangeList() {.exportc, dynlib.} =
   ## When the SV notifier signal is toggled, the SV code must immediately
   ## call this function.  It will service all pending value-change events,
   ## notifying each affected probe object in turn by calling exported
   ## function vlab_probes_vcNotify for that signal.
-  while changeList != nil:
+  while changeList.len > 0:
+    let
+      h = changeList_pop()
+    vlab_probes_vcNotify(hooks.records[h].sv_key)
+
+proc vlab_probes_drainChangeList(keys: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Batched alternative to vlab_probes_processChangeList: instead of
+  ## calling the DPI export vlab_probes_vcNotify once per changed
+  ## signal, pop the pending entries off the changeList and write their
+  ## sv_keys into the open int array `keys`, all in one DPI crossing.
+  ## Returns the number of keys written.  If `keys` is too small to
+  ## take all of them, the remainder stay on the changeList (and the
+  ## notifier is not toggled again for them) until the next call.
+  let
+    arrLow = svLow(keys, 1)
+    arrSize = svSize(keys, 1)
+  var
+    n: cint
+  while changeList.len > 0 and n < arrSize:
+    let
+      h = changeList_pop()
+    cast[ptr cint](svGetArrElemPtr1(keys, arrLow + n))[] = hooks.records[h].sv_key
+    inc n
+  return n
+
+proc vlab_probes_setHistoryDepth(hnd: cuint; depth: cint): cint {.exportc, dynlib.} =
+  ## Opt the signal referenced by `hnd` in to (`depth` > 0) or out of
+  ## (`depth` = 0) value history.  With history enabled, the
+  ## value-change callback collects the new value and the time of every
+  ## change, and keeps the most recent `depth` of them in a ring buffer
+  ## that is allocated here, once.  This catches every intermediate
+  ## value, even those that SV never gets to see because the signal
+  ## changed again before SV serviced the changeList.  Changing the
+  ## depth discards any history collected so far.
+  ## Returns 0 if success, 1 if failure (bad handle, negative depth).
+  let
+    h = handle_to_hook(hnd)
+  if h < 0:
+    return QuitFailure
+  if depth < 0:
+    report_error("vlab_probes_setHistoryDepth: negative depth")
+    return QuitFailure
+
+  # The value-change callback must be re-registered to start or stop
+  # collecting the value and time.
+  let
+    wasEnabled = hooks.enabled[h]
+  disable_cb(h)
+  template rec: untyped = hooks.records[h]
+  rec.historyDepth = depth
+  rec.historyHead = 0
+  rec.historyCount = 0
+  rec.historyValues = newSeq[svLogicVecVal](depth * h.numWords)
+  rec.historyTimes = newSeq[int64](depth)
+  if wasEnabled:
+    enable_cb(h)
+  return QuitSuccess
+
+proc vlab_probes_getHistory(hnd: cuint; values: svOpenArrayHandle; times: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Copy the value history of the signal referenced by `hnd`, most
+  ## recent change first, into the open arrays `values` and `times`.
+  ## Entry i occupies words [i*N +: N] of `values`, where N is the
+  ## number of 32-bit words in the signal, and its time is times[i].
+  ## As many entries are copied as fit in both arrays.  The history
+  ## itself is left untouched.
+  ## Returns the number of entries copied.
+  let
+    h = handle_to_hook(hnd)
+  if h < 0 or hooks.records[h].historyDepth == 0:
+    return 0
+
+  template rec: untyped = hooks.records[h]
+  let
+    nWords = h.numWords
+    valuesLow = svLow(values, 1)
+    timesLow = svLow(times, 1)
+    n = min(rec.historyCount, min(svSize(values, 1) div nWords, svSize(times, 1)))
+  for i in 0 ..< n:
+    let
+      slot = h.historySlot(i)
+    for w in 0 ..< nWords:
+      let
+        resultPtr = cast[ptr svLogicVecVal](svGetArrElemPtr1(values, valuesLow + cint(i * nWords + w)))
+      resultPtr[] = rec.historyValues[slot * nWords + w]
+      if w == nWords - 1:
+        h.extendTopWord(resultPtr[])
+    cast[ptr int64](svGetArrElemPtr1(times, timesLow + i.cint))[] = rec.historyTimes[slot]
+  return n.cint
+
+proc vlab_probes_getPast(hnd: cuint; index: cint; value: svOpenArrayHandle; time: ptr int64): cint {.exportc, dynlib.} =
+  ## $past-style access to the value history of the signal referenced
+  ## by `hnd`: copy the value that the signal took at its `index`'th
+  ## most recent change (index 0 is the latest change) into `value`,
+  ## laid out as for vlab_probes_getValue, and its time into `time`.
+  ## Returns 0 if success, 1 if there is no such entry in the history.
+  let
+    h = handle_to_hook(hnd)
+  if h < 0:
+    return QuitFailure
+  template rec: untyped = hooks.records[h]
+  if index < 0 or index >= rec.historyCount:
+    return QuitFailure
+
+  let
+    nWords = h.numWords
+    slot = h.historySlot(index)
+    arrLow = svLow(value, 1)
+  if svSize(value, 1) < nWords:
+    report_error(&"vlab_probes_getPast: array of {svSize(value, 1)} words cannot hold {hooks.size[h]} bits")
+    return QuitFailure
+  for w in 0 ..< nWords:
+    let
+      resultPtr = cast[ptr svLogicVecVal](svGetArrElemPtr1(value, arrLow + w.cint))
+    resultPtr[] = rec.historyValues[slot * nWords + w]
+    if w == nWords - 1:
+      h.extendTopWord(resultPtr[])
+  time[] = rec.historyTimes[slot]
+  return QuitSuccess
+
+proc vlab_probes_reportNameIndex() {.exportc, dynlib.} =
+  ## Print the hit/miss counters of the index that resolves the signal
+  ## names given to vlab_probes_create, vlab_probes_createMany and
+  ## vlab_probes_specifyNotifier.
+  reportNameIndex("*I,VLAB_PROBES: ")
+
+proc vlab_probes_setFilter(hnd: cuint; mode: cint; mask: svOpenArrayHandle; value: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Attach a filter to the signal referenced by `hnd`, so that only the
+  ## value-changes that SV is interested in get on the changeList; the
+  ## others are dropped inside the value-change callback.  `mode` is
+  ## one of:
+  ##   0: no filter, every change is passed on
+  ##   1: posedge on the LSB of the signal
+  ##   2: negedge on the LSB of the signal
+  ##   3: the bits selected by `mask` become equal to `value`
+  ##   4: any of the bits selected by `mask` changes
+  ## `mask` (an open array of 32-bit bit words) and `value` (an open
+  ## array of 32-bit logic words) are laid out as for
+  ## vlab_probes_getValue.  Missing words of `mask` and `value` are
+  ## taken as 0, except that an empty `mask` selects all the bits.
+  ## Returns 0 if success, 1 if failure (bad handle, bad mode).
+  let
+    h = handle_to_hook(hnd)
+  if h < 0:
+    return QuitFailure
+  if mode < ord(FilterMode.low) or mode > ord(FilterMode.high):
+    report_error(&"vlab_probes_setFilter: bad filter mode {mode}")
+    return QuitFailure
+
+  let
+    nWords = h.numWords
+    maskLow = svLow(mask, 1)
+    maskSize = svSize(mask, 1)
+    valueLow = svLow(value, 1)
+    valueSize = svSize(value, 1)
+  template rec: untyped = hooks.records[h]
+  rec.filterMask = newSeq[uint32](nWords)
+  rec.filterValue = newSeq[svLogicVecVal](nWords)
+  for w in 0 ..< nWords:
+    if maskSize == 0:
+      rec.filterMask[w] = not 0'u32
+    elif w < maskSize:
+      rec.filterMask[w] = cast[ptr uint32](svGetArrElemPtr1(mask, maskLow + w.cint))[]
+    if w < valueSize:
+      rec.filterValue[w] = cast[ptr svLogicVecVal](svGetArrElemPtr1(value, valueLow + w.cint))[]
+  rec.filterMask[nWords - 1] = rec.filterMask[nWords - 1] and rec.top_mask
+
+  # The value-change callback must be re-registered if it has to
+  # start or stop collecting the value.
+  let
+    wasEnabled = hooks.enabled[h]
+  disable_cb(h)
+  rec.filterMode = FilterMode(mode)
+  if wasEnabled:
+    enable_cb(h)
+  return QuitSuccess
+
+proc vlab_probes_startExport(logfile: cstring; capacity: cint; waitWhenFull: cint): cint {.exportc, dynlib.} =
+  ## Start exporting the value-changes of all the enabled signals (that
+  ## pass their filters) to a worker thread, through a lock-free ring
+  ## buffer of at least `capacity` bytes.  The worker appends them to
+  ## the binary log `logfile` (unless it is empty; see probe_export.nim
+  ## for the format) and passes them to any Nim handlers registered
+  ## with registerExportHandler.  If the ring is full, the value-change
+  ## callback waits for room if `waitWhenFull` is true (non-zero), and
+  ## drops the change otherwise; either way it is counted, see
+  ## vlab_probes_getExportStats.  The export stops at the end of the
+  ## simulation, or on vlab_probes_stopExport.
+  ## Needs a library built with threads on (make NIM_THREADS=1).
+  ## Returns 0 if success, 1 if failure.
+  when not compileOption("threads"):
+    report_error("vlab_probes_startExport: the library must be built with NIM_THREADS=1")
+    return QuitFailure
+  if exportRunning():
+    report_error("vlab_probes_startExport: the export is already running")
+    return QuitFailure
+  if not startExport($logfile, capacity, waitWhenFull != 0):
+    report_error(&"vlab_probes_startExport: could not start the export to \"{logfile}\"")
+    return QuitFailure
+  setup_end_callback()
+  # The callbacks must now collect the values of all the signals.
+  for s in 0 ..< sources.obj.len:
+    sync_source_cb(s)
+  return QuitSuccess
+
+proc vlab_probes_stopExport() {.exportc, dynlib.} =
+  ## Stop exporting value-changes, once the worker thread has dealt
+  ## with all the changes already in the ring.
+  if exportRunning():
+    stopExport()
+    for s in 0 ..< sources.obj.len:
+      sync_source_cb(s)
+
+proc vlab_probes_getExportStats(stats: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Get the back-pressure statistics of the export ring, to help size
+  ## it.  The open longint array `stats` receives, in this order:
+  ##   0: changes put into the ring
+  ##   1: changes dropped because the ring was full
+  ##   2: changes that had to wait for room in the ring
+  ##   3: largest number of bytes ever in use in the ring
+  ##   4: changes taken out by the worker thread
+  ##   5: size of the ring, in bytes
+  ## Returns the number of elements written.
+  let
+    st = exportStats()
+    values = [st.pushed, st.dropped, st.waits, st.highWater, st.consumed, st.capacity]
+    arrLow = svLow(stats, 1)
+    n = min(values.len, svSize(stats, 1))
+  for i in 0 ..< n:
+    cast[ptr int64](svGetArrElemPtr1(stats, arrLow + i.cint))[] = values[i]
+  return n.cint
+
+proc vlab_probes_setInstrumentation(enable: cint) {.exportc, dynlib.} =
+  ## Start (`enable` non-zero) or stop keeping activity counters for
+  ## every signal (callbacks received, changeList pushes, notifications
+  ## delivered and notifier toggles caused) and a histogram of the
+  ## wall-clock delay between each value-change callback and the
+  ## delivery of the change to SV.  While they are kept, the 20
+  ## busiest signals are reported at the end of the simulation.
+  instrumented = enable != 0
+  if instrumented:
+    setup_end_callback()
+
+proc vlab_probes_reportStats(topN: cint) {.exportc, dynlib.} =
+  ## Print the activity counters of the `topN` signals with the most
+  ## value-change callbacks, and the latency histogram.
+  report_stats(topN)
+
+proc vlab_probes_createSampler(handles: svOpenArrayHandle): cuint {.exportc, dynlib.} =
+  ## Create a sampler on the signals referenced by the open array of
+  ## handles `handles`, and return its handle (0 on failure).  While it
+  ## is running (see vlab_probes_startSampler), a single cbAfterDelay
+  ## callback samples all of the signals every period, and those whose
+  ## value differs from the previous sample are put on the changeList
+  ## like value-changes, through their filters and history.  Changes
+  ## between two samples are not seen at all, in exchange for a much
+  ## lower callback rate on busy signals.  Value-change callbacks on the
+  ## signals are disabled.
+  let
+    arrLow = svLow(handles, 1)
+  var
+    members: seq[int32]
+  for i in 0.cint ..< svSize(handles, 1):
+    let
+      h = handle_to_hook(cast[ptr cuint](svGetArrElemPtr1(handles, arrLow + i))[])
+    if h < 0:
+      return 0
+    members.add(h.int32)
+  if samplers.period.len > hookIndexMask.int:
+    report_error("vlab_probes_createSampler: too many samplers")
+    return 0
+  return add_sampler(members, 0).hook_to_handle
+
+proc handle_to_sampler(hnd: cuint): int =
+  ## As handle_to_hook, for the handle of a sampler.
+  let
+    p = int(hnd and hookIndexMask)
+  if (hnd shr hookIndexBits) == generation and p < samplers.period.len:
+    return p
+  else:
+    stop_on_error("Bad handle argument is not a valid created sampler")
+    return -1
+
+proc vlab_probes_startSampler(hnd: cuint; period: int64): cint {.exportc, dynlib.} =
+  ## Start (or restart) the sampler referenced by `hnd`, sampling every
+  ## `period` simulation time units (vpiSimTime), starting one period
+  ## from now.  The values of the signals now are the baseline that the
+  ## first sample is compared against.
+  ## Returns 0 if success, 1 if failure (bad handle, period not positive).
+  let
+    p = handle_to_sampler(hnd)
+  if p < 0:
+    return QuitFailure
+  if period <= 0:
+    report_error(&"vlab_probes_startSampler: period {period} is not positive")
+    return QuitFailure
+  start_sampler(p, period)
+  return QuitSuccess
+
+proc vlab_probes_stopSampler(hnd: cuint) {.exportc, dynlib.} =
+  ## Stop the sampler referenced by `hnd`.  Its signals are left with
+  ## value-change callbacks disabled.
+  let
+    p = handle_to_sampler(hnd)
+  if p >= 0 and samplers.cb[p] != nil:
+    discard vpi_remove_cb(samplers.cb[p])
+    samplers.cb[p] = nil
+
+proc vlab_probes_applyPuts(handles, values, delays, modes: svOpenArrayHandle): cint {.exportc, dynlib.} =
+  ## Write-side counterpart of the probes: drive each of the signals
+  ## referenced by the open array of handles `handles`, in order, all
+  ## in one DPI call.  Entry i takes the next N words of the open array
+  ## of 32-bit logic words `values` (N being the number of words in
+  ## signal i, least significant word first, as for
+  ## vlab_probes_getValue), the delay delays[i] in simulation time units
+  ## (vpiSimTime), and the vpi_put_value flag modes[i]: vpiNoDelay (a
+  ## deposit), vpiInertialDelay, vpiTransportDelay,
+  ## vpiPureTransportDelay, vpiForceFlag or vpiReleaseFlag.
+  ## Returns the number of entries that could not be applied.
+  let
+    n = svSize(handles, 1)
+    handlesLow = svLow(handles, 1)
+    valuesLow = svLow(values, 1)
+    valuesSize = svSize(values, 1)
+    delaysLow = svLow(delays, 1)
+    modesLow = svLow(modes, 1)
+  if svSize(delays, 1) < n or svSize(modes, 1) < n:
+    report_error("vlab_probes_applyPuts: the arrays of delays and modes are smaller than the array of handles")
+    return n
+  var
+    failures: cint
+    offset = 0
+    words: seq[svLogicVecVal]
+    value_s = s_vpi_value(format: vpiVectorVal)
+    time_s = s_vpi_time(`type`: vpiSimTime)
+  for i in 0.cint ..< n:
+    let
+      h = handle_to_hook(cast[ptr cuint](svGetArrElemPtr1(handles, handlesLow + i))[])
+      delay = cast[ptr int64](svGetArrElemPtr1(delays, delaysLow + i))[]
+      mode = cast[ptr cint](svGetArrElemPtr1(modes, modesLow + i))[]
+    if h < 0:
+      # The words of a bad entry cannot be skipped, as its size is unknown.
+      return failures + (n - i)
+    let
+      nWords = h.numWords
+    if offset + nWords > valuesSize:
+      report_error(&"vlab_probes_applyPuts: the array of values ends in entry {i}")
+      return failures + (n - i)
+    if mode.int notin {vpiNoDelay.int, vpiInertialDelay, vpiTransportDelay, vpiPureTransportDelay,
+                       vpiForceFlag, vpiReleaseFlag}:
+      report_error(&"vlab_probes_applyPuts: bad mode {mode} in entry {i}")
+      inc failures
+      offset += nWords
+      continue
+
+    words.setLen(nWords)
+    for w in 0 ..< nWords:
+      words[w] = cast[ptr svLogicVecVal](svGetArrElemPtr1(values, valuesLow + cint(offset + w)))[]
+    offset += nWords
+    value_s = s_vpi_value(format: vpiVectorVal)
+    value_s.value.vector = cast[ptr s_vpi_vecval](addr words[0])
+    time_s.high = uint32(delay shr 32)
+    time_s.low = uint32(delay and 0xffff_ffff)
     let
-      hook = changeList_pop()
-    vlab_probes_vcNotify(hook.sv_key)
+      event = vpi_put_value(hooks.obj[h], addr value_s,
+                            if mode.int in {vpiInertialDelay.int, vpiTransportDelay, vpiPureTransportDelay}: addr time_s else: nil,
+                            mode)
+    if vpi_chk_error(nil) != 0:
+      inc failures
+    elif event != nil:
+      discard vpi_release_handle(event)
+  return failures
@@ -0,0 +1,207 @@
+import std/[atomics, os]
+import svdpi
+
+## Export of probe value-changes to a background thread.
+##
+## The value-change callback (the producer, on the simulator thread)
+## copies each change into a single-producer/single-consumer ring
+## buffer, and a worker thread (the consumer) takes the changes out
+## again, appends them to a compact binary log and/or passes them to
+## the handlers registered with `registerExportHandler`.  Neither side
+## ever takes a lock: the producer only moves `tail`, the consumer only
+## moves `head`, and each only reads the other's counter.
+##
+## Each record in the ring is a `RecordHeader` followed by the aval/bval
+## words of the value, padded to a multiple of 16 bytes.  A record never
+## wraps around the end of the ring; when it does not fit there, a
+## padding record (key -1) fills the rest and the record goes at the
+## start.
+##
+## The log file starts with the 8 bytes "VLPEXP01", followed by one
+## record per value-change: the 16-byte header, then the value words,
+## without padding.  All in the host's byte order.
+##
+## The worker thread needs a build with threads on (make NIM_THREADS=1);
+## without that, `startExport` always fails.
+
+type
+  ExportHandler* = proc (key: int32; time: int64; value: openArray[svLogicVecVal]) {.nimcall, gcsafe.}
+    ## Called on the worker thread for every exported value-change.
+
+  RecordHeader = object
+    key: int32       ## sv_key of the probe, or -1 for padding
+    nWords: int32    ## number of aval/bval words in the value
+    time: int64      ## time of the value-change (vpiSimTime)
+
+  ExportStats* = object
+    pushed*: int64     ## records written into the ring
+    dropped*: int64    ## records dropped because the ring was full
+    waits*: int64      ## records that had to wait for room in the ring
+    highWater*: int64  ## largest number of bytes ever in use in the ring
+    consumed*: int64   ## records taken out by the worker thread
+    capacity*: int64   ## size of the ring, in bytes
+
+  Ring = object
+    buf: ptr UncheckedArray[byte]
+    capacity: int          ## a power of two
+    head: Atomic[int]      ## bytes consumed so far (only the consumer moves it)
+    tail: Atomic[int]      ## bytes produced so far (only the producer moves it)
+    consumed: Atomic[int]  ## records consumed so far
+
+const
+  maxHandlers = 8
+
+var
+  ring: Ring
+  running: bool           ## true between startExport and stopExport
+  blockWhenFull: bool     ## wait for room rather than drop records
+  stopping: Atomic[bool]  ## tells the worker to finish off and exit
+  logFile: File
+  logging: bool
+  handlers: array[maxHandlers, ExportHandler]
+  handlerCount: int
+  stats: ExportStats      ## producer-side counters
+
+proc recordSize(nWords: int): int =
+  ## Bytes taken in the ring by a record with `nWords` value words.
+  return (sizeof(RecordHeader) + nWords * sizeof(svLogicVecVal) + 15) and not 15
+
+proc registerExportHandler*(handler: ExportHandler): bool =
+  ## Have `handler` called for each exported value-change.  Handlers
+  ## must be registered before the export is started.
+  ## Returns false if there are too many handlers, or if the export
+  ## is already running.
+  if running or handlerCount == maxHandlers:
+    return false
+  handlers[handlerCount] = handler
+  inc handlerCount
+  return true
+
+proc exportRunning*(): bool {.inline.} =
+  ## True if value-changes are being exported.
+  return running
+
+proc exportStats*(): ExportStats =
+  ## Return the back-pressure statistics of the ring.
+  result = stats
+  result.consumed = ring.consumed.load(moRelaxed)
+  result.capacity = ring.capacity
+
+proc pushChange*(key: int32; time: int64; vecPtr: pointer; nWords: int) =
+  ## Copy a value-change into the ring.  If the ring is full, either
+  ## wait for the worker to make room, or drop the change, as chosen
+  ## by startExport.
+  let
+    size = recordSize(nWords)
+    mask = ring.capacity - 1
+    tail = ring.tail.load(moRelaxed)
+    pos = tail and mask
+    pad = if pos + size > ring.capacity: ring.capacity - pos else: 0
+  if pad + size > ring.capacity:
+    inc stats.dropped
+    return
+  var
+    head = ring.head.load(moAcquire)
+  if tail + pad + size - head > ring.capacity:
+    if not blockWhenFull:
+      inc stats.dropped
+      return
+    inc stats.waits
+    while tail + pad + size - head > ring.capacity:
+      cpuRelax()
+      head = ring.head.load(moAcquire)
+
+  if pad > 0:
+    cast[ptr RecordHeader](addr ring.buf[pos])[] = RecordHeader(key: -1)
+  let
+    start = (tail + pad) and mask
+  cast[ptr RecordHeader](addr ring.buf[start])[] = RecordHeader(key: key, nWords: nWords.int32, time: time)
+  copyMem(addr ring.buf[start + sizeof(RecordHeader)], vecPtr, nWords * sizeof(svLogicVecVal))
+  ring.tail.store(tail + pad + size, moRelease)
+  inc stats.pushed
+  stats.highWater = max(stats.highWater, int64(tail + pad + size - head))
+
+when compileOption("threads"):
+  var
+    worker: Thread[void]
+
+  proc consume() {.thread.} =
+    ## The worker thread: take records out of the ring until told to
+    ## stop and the ring is empty.
+    let
+      mask = ring.capacity - 1
+    while true:
+      let
+        tail = ring.tail.load(moAcquire)
+      var
+        head = ring.head.load(moRelaxed)
+      if head == tail:
+        if stopping.load(moAcquire) and ring.tail.load(moAcquire) == head:
+          break
+        sleep(1)
+        continue
+      while head != tail:
+        let
+          hdr = cast[ptr RecordHeader](addr ring.buf[head and mask])
+        if hdr.key < 0:
+          head += ring.capacity - (head and mask)
+        else:
+          let
+            words = cast[ptr UncheckedArray[svLogicVecVal]](addr ring.buf[(head and mask) + sizeof(RecordHeader)])
+          if logging:
+            discard logFile.writeBuffer(hdr, sizeof(RecordHeader))
+            discard logFile.writeBuffer(words, hdr.nWords * sizeof(svLogicVecVal))
+          for i in 0 ..< handlerCount:
+            handlers[i](hdr.key, hdr.time, toOpenArray(words, 0, hdr.nWords - 1))
+          head += recordSize(hdr.nWords)
+          discard ring.consumed.fetchAdd(1, moRelaxed)
+        # Hand the space back to the producer straight away.
+        ring.head.store(head, moRelease)
+    if logging:
+      logFile.flushFile()
+
+proc startExport*(logPath: string; capacity: int; waitWhenFull: bool): bool =
+  ## Start exporting value-changes through a ring of at least
+  ## `capacity` bytes, writing them to the log file `logPath` (unless
+  ## it is empty) and passing them to the registered handlers.
+  ## Returns false if the export could not be started.
+  when compileOption("threads"):
+    if running:
+      return false
+    if logPath.len > 0:
+      if not open(logFile, logPath, fmWrite):
+        return false
+      logFile.write("VLPEXP01")
+    logging = logPath.len > 0
+    var
+      size = 4096
+    while size < capacity:
+      size = size shl 1
+    ring.buf = cast[ptr UncheckedArray[byte]](allocShared0(size))
+    ring.capacity = size
+    ring.head.store(0)
+    ring.tail.store(0)
+    ring.consumed.store(0)
+    stats = ExportStats()
+    blockWhenFull = waitWhenFull
+    stopping.store(false)
+    running = true
+    createThread(worker, consume)
+    return true
+  else:
+    return false
+
+proc stopExport*() =
+  ## Let the worker thread drain the ring, wait for it to finish, and
+  ## close the log.  The statistics stay readable until the next start.
+  when compileOption("threads"):
+    if not running:
+      return
+    running = false
+    stopping.store(true, moRelease)
+    joinThread(worker)
+    if logging:
+      logFile.close()
+      logging = false
+    deallocShared(ring.buf)
+    ring.buf = nil
@@ -0,0 +1,3 @@
+# Run the simulation restarted from the snapshot of save.tcl to the end.
+run
+exit
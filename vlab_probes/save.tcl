@@ -0,0 +1,6 @@
+# Run to the middle of tb.sv, save a snapshot of the simulation (the
+# probe table goes with it), and carry on to the end.
+run 1000ns
+save -overwrite vlab_probes_snap
+run
+exit
@@ -1 +0,0 @@
-orig/tb.sv
\ No newline at end of file
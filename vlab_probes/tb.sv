@@ -0,0 +1,422 @@
+//-----------------------------------------------------------------------------
+// File:        test.sv
+// Author:      Jonathan Bromley, Verilab
+// Description: Simple demonstration/test for vlab_probes package
+//-----------------------------------------------------------------------------
+//
+// Copyright 2012 Verilab GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//-----------------------------------------------------------------------------
+
+`timescale 1ns/1ps
+
+//--------------------------
+`define RUNTIME 10000
+//--------------------------
+
+//-----------------------------------------------------------------------------
+module simple_wiggler #(parameter ID = 0);
+
+  localparam DELAY = (ID%20) + 5;  // just to mix up the periodicity a bit
+
+  logic s;
+  int sig_changes;
+
+  initial begin
+    #10 s = 0;
+    while ($time < `RUNTIME) begin
+      #(DELAY) s = ~s;
+      sig_changes++;
+      if (ID%1) begin
+        // odd-numbered IDs only...
+        s <= ~s;  // create transition after one NBA delay
+        sig_changes++;
+      end
+    end
+  end
+
+endmodule
+
+//-----------------------------------------------------------------------------
+module vector_wiggler #(parameter ID = 0, nBits = 2);
+
+  localparam DELAY = (ID%20) + 2;
+
+  logic [nBits-1:0] s;
+  int sig_changes;
+
+  initial begin
+    #10 s = 0;
+    // Make a Johnson counter that loops 000,100,110,111,011,001,000,...
+    while ($time < `RUNTIME) begin
+      #(DELAY)
+      s = { ~s[0], s[nBits-1:1] };
+      sig_changes++;
+    end
+  end
+
+endmodule
+
+//-----------------------------------------------------------------------------
+module observe_and_compare #(parameter nBits = 1) (input [nBits-1:0] sig);
+
+  localparam int nChunks = ((nBits+31)/32);
+
+  vlab_probes_pkg::signal_probe p;  // set up by the test
+
+  int detected_changes, sig_changes;
+  logic [32*nChunks-1:0] result;
+  logic [31:0] chunks[];
+
+  // Detect and count changes on the real signal
+  always @sig begin
+    test.sig_changes++;
+    sig_changes++;
+  end
+
+  // Respond to changes detected by the signal probe
+  initial wait (p!=null) begin
+    $display("module %m sensing %0d-bit signal %s", p.getSize(), p.getName());
+    forever begin
+      p.waitForChange();
+      test.detected_changes++;
+      detected_changes++;
+      p.getValue(chunks);
+      foreach (chunks[chunk]) begin
+        // chunk == 0 -> result[31: 0]
+        // chunk == 1 -> result[63:32]
+        result[chunk*32 +: 32] = chunks[chunk];
+      end
+      // The per-chunk reads must agree with the single-call read.
+      for (int chunk = 0; chunk < nChunks; chunk++) begin
+        assert (p.getValue32(chunk) === chunks[chunk]) else
+          $display("ERROR: %s getValue32(%0d) disagrees with getValue()", p.getName(), chunk);
+      end
+    end
+  end
+
+  // Error checking
+  //
+  // We cannot depend on event ordering, so it's impossible to decide
+  // precisely when to check for errors.  So we introduce a small
+  // inertial delay in the error check logic, so an error must persist
+  // for a small non-zero time before being detected.
+
+  wire #1ps value_error = (result[nBits-1:0] !== sig);
+  wire #1ps count_error = (sig_changes != detected_changes);
+
+  initial wait (p!=null) forever @(value_error, count_error) begin
+    if (value_error) begin
+      $display("ERROR: %s observed %b, expected %b\n",
+               p.getName(), result[nBits-1:0], sig);
+    end
+    if (count_error) begin
+      $display("ERROR: %s sig_changes=%0d, detected_changes=%0d\n",
+               p.getName(), sig_changes, detected_changes);
+    end
+  end
+endmodule
+
+
+//-----------------------------------------------------------------------------
+
+module test;
+
+  // Get the signal-probe functionality
+  import vlab_probes_pkg::signal_probe;
+  import vlab_probes_pkg::signal_probe_group;
+  import vlab_probes_pkg::signal_drive_batch;
+
+  int sig_changes, detected_changes;
+
+  generate
+    genvar i;
+    for (i=0; i<5; i=i+1) begin: testloop
+      simple_wiggler #(.ID(i)) w();
+      observe_and_compare #(1) obs(w.s);
+      initial obs.p = signal_probe::create($sformatf("test.testloop[%0d].w.s", i));
+    end
+    for (i=31; i<=33; i++) begin: vecloop
+      vector_wiggler #(.ID(i), .nBits(i)) w();
+      observe_and_compare #(i) obs(w.s);
+      initial obs.p = signal_probe::create($sformatf("test.vecloop[%0d].w.s", i));
+    end
+  endgenerate
+
+  // Service all the vector probes from a single process, as a group.
+  signal_probe_group vec_group = new();
+  int group_changes;
+
+  initial begin
+    int keys[$];
+    wait (vecloop[31].obs.p != null && vecloop[32].obs.p != null && vecloop[33].obs.p != null);
+    vec_group.add(vecloop[31].obs.p);
+    vec_group.add(vecloop[32].obs.p);
+    vec_group.add(vecloop[33].obs.p);
+    forever begin
+      vec_group.waitForAnyChange(keys);
+      foreach (keys[i]) begin
+        assert (vec_group.getProbe(keys[i]) != null) else
+          $display("ERROR: group reported key %0d that is not a member", keys[i]);
+      end
+      group_changes += keys.size();
+    end
+  end
+
+  // Keep a value history on one of the probes; its latest entry must
+  // always agree with the signal itself.
+  initial begin
+    wait (testloop[1].obs.p != null);
+    testloop[1].obs.p.setHistoryDepth(8);
+    forever begin
+      logic [31:0] values[];
+      longint times[];
+      int n;
+      testloop[1].obs.p.waitForChange();
+      n = testloop[1].obs.p.getHistory(values, times);
+      assert ((n > 0) && (values[0][0] === testloop[1].w.s)) else
+        $display("ERROR: %s history[0] is %b, expected %b",
+                 testloop[1].obs.p.getName(), values[0][0], testloop[1].w.s);
+    end
+  end
+
+  // A second probe on one of the signals, that only wakes up on its
+  // posedges, and so must see exactly one in two of its changes.
+  int posedges, posedges_seen;
+  always @(posedge testloop[2].w.s) posedges++;
+  initial begin
+    signal_probe p;
+    wait (testloop[2].obs.p != null);
+    p = signal_probe::create(testloop[2].obs.p.getName());
+    p.setFilter(signal_probe::FILTER_POSEDGE);
+    forever begin
+      p.waitForChange();
+      posedges_seen++;
+      assert (p.getValue32() === 1) else
+        $display("ERROR: %s posedge filter woke up on value %b", p.getName(), p.getValue32());
+    end
+  end
+
+  // Sample a counter with a group sampler instead of value-change
+  // callbacks.  The counter moves half-way between two samples, so
+  // every sample must report it, with the value it has then.  The
+  // period is in simulation precision units (1ps here).
+  logic [15:0] samp_sig = 0;
+  int samples;
+  signal_probe_group samp_group = new();
+
+  initial begin
+    #5;
+    forever #10 samp_sig++;
+  end
+
+  initial begin
+    int keys[$];
+    #100;
+    samp_group.add(signal_probe::create("test.samp_sig", 0));
+    samp_group.startSampling(10_000);
+    forever begin
+      samp_group.waitForAnyChange(keys);
+      samples++;
+      assert ((keys.size() == 1) && (samp_group.getProbe(keys[0]).getValue32() === samp_sig)) else
+        $display("ERROR: sampler reported %0d keys, value %h, expected %h", keys.size(),
+                 samp_group.getProbe(keys[0]).getValue32(), samp_sig);
+    end
+  end
+
+  initial begin
+    // Samples at 110ns, 120ns, .. 300ns.
+    #305 samp_group.stopSampling();
+    assert (samples == 20) else
+      $display("ERROR: samples = %0d after 20 sampling periods", samples);
+    #50 assert (samples == 20) else
+      $display("ERROR: samples = %0d after the sampler was stopped", samples);
+  end
+
+  // Queue deposits on two variables (one of them two words wide) and
+  // a force on a net, apply them in one call, then release the net,
+  // which must go back to the value of its driver.
+  logic [7:0]  drv_a = 0;
+  logic [39:0] drv_b = 0;
+  logic [7:0]  drv_src = 8'h11;
+  wire  [7:0]  drv_w = drv_src;
+
+  initial begin
+    signal_probe pa, pb, pw;
+    signal_drive_batch batch = new();
+    #200;
+    pa = signal_probe::create("test.drv_a", 0);
+    pb = signal_probe::create("test.drv_b", 0);
+    pw = signal_probe::create("test.drv_w", 0);
+    batch.add(pa, '{32'h5a});
+    batch.add(pb, '{32'hdeadbeef, 32'h12});
+    batch.add(pw, '{32'ha5}, signal_drive_batch::DRIVE_FORCE);
+    assert (batch.size() == 3) else
+      $display("ERROR: drive batch size = %0d, expected 3", batch.size());
+    assert (batch.apply() == 0) else
+      $display("ERROR: drive batch failed to apply");
+    assert (batch.size() == 0) else
+      $display("ERROR: drive batch not empty after apply()");
+    #1;
+    assert ((drv_a === 8'h5a) && (drv_b === 40'h12_deadbeef) && (drv_w === 8'ha5)) else
+      $display("ERROR: after the batch, drv_a = %h, drv_b = %h, drv_w = %h", drv_a, drv_b, drv_w);
+    drv_src = 8'h22;
+    #1;
+    assert (drv_w === 8'ha5) else
+      $display("ERROR: forced drv_w followed its driver to %h", drv_w);
+    batch.add(pw, , signal_drive_batch::DRIVE_RELEASE);
+    assert (batch.apply() == 0) else
+      $display("ERROR: drive batch failed to release drv_w");
+    #1;
+    assert (drv_w === 8'h22) else
+      $display("ERROR: released drv_w = %h, expected 22", drv_w);
+  end
+
+  // Export a wide variable through the smallest ring, without waiting
+  // for room, and change it many times within one time step, so that
+  // some of the changes must be dropped.  Nothing else runs between
+  // the start and the stop of the export, so every change was either
+  // put into the ring or dropped, and the worker has handled all those
+  // put in once stopExport() returns.  The log holds the 8-byte header
+  // and one 16-byte header plus 32 value words per change put in.
+  logic [1023:0] exp_sig = 0;
+
+  initial begin
+    signal_probe::export_stats_t st;
+    int fd;
+    string magic;
+    #400;
+    void'(signal_probe::create("test.exp_sig"));
+    assert (signal_probe::startExport("exp_sig.vlpexp", 0, 0)) else
+      $display("ERROR: export did not start (build with NIM_THREADS=1)");
+    for (int n = 0; n < 2000; n++)
+      exp_sig = {32{n}};
+    signal_probe::stopExport();
+    st = signal_probe::getExportStats();
+    $display("export: pushed = %0d, dropped = %0d, consumed = %0d, high_water = %0d of %0d bytes",
+             st.pushed, st.dropped, st.consumed, st.high_water, st.capacity);
+    assert (st.pushed + st.dropped == 2000) else
+      $display("ERROR: export pushed %0d + dropped %0d changes, expected 2000", st.pushed, st.dropped);
+    assert (st.dropped > 0) else
+      $display("ERROR: export of 2000 changes into a %0d-byte ring dropped none", st.capacity);
+    assert (st.consumed == st.pushed) else
+      $display("ERROR: export consumed %0d changes, pushed %0d", st.consumed, st.pushed);
+    fd = $fopen("exp_sig.vlpexp", "rb");
+    magic = "";
+    repeat (8) magic = {magic, string'($fgetc(fd))};
+    assert (magic == "VLPEXP01") else
+      $display("ERROR: export log starts with \"%s\", expected \"VLPEXP01\"", magic);
+    void'($fseek(fd, 0, 2));
+    assert ($ftell(fd) == 8 + st.pushed * (16 + 32 * 8)) else
+      $display("ERROR: export log is %0d bytes, expected %0d", $ftell(fd), 8 + st.pushed * (16 + 32 * 8));
+    $fclose(fd);
+  end
+
+  // Probes set up before the snapshot that `make restart` saves at
+  // 1000ns (see save.tcl).  In the run restarted from it, the probe
+  // objects come back from the snapshot, and must keep working through
+  // the handles the library restores: keys, enables, the filter, the
+  // history depth and the sampler, checked over 1005ns .. 2005ns.  The
+  // same checks hold on a plain run.
+  logic [7:0] rs_sig = 0;
+  logic [7:0] rs_samp = 0;
+  int rs_changes, rs_masked, rs_samples;
+  signal_probe rs_p, rs_mask, rs_off, rs_s;
+  signal_probe_group rs_group = new();
+
+  initial forever #10 rs_sig++;
+  initial begin
+    #5;
+    forever #10 rs_samp++;
+  end
+
+  initial begin
+    #500;
+    rs_p = signal_probe::create("test.rs_sig");
+    rs_p.setHistoryDepth(4);
+    rs_mask = signal_probe::create("test.rs_sig");
+    rs_mask.setFilter(signal_probe::FILTER_ANY_BIT_IN_MASK, '{32'h4});
+    rs_off = signal_probe::create("test.rs_sig", 0);
+    rs_s = signal_probe::create("test.rs_samp", 0);
+    rs_group.add(rs_s);
+    rs_group.startSampling(10_000);
+    fork
+      forever begin
+        rs_p.waitForChange();
+        rs_changes++;
+      end
+      forever begin
+        rs_mask.waitForChange();
+        rs_masked++;
+        assert (rs_sig[1:0] === 2'b00) else
+          $display("ERROR: %s mask filter woke up on value %h", rs_mask.getName(), rs_sig);
+      end
+      forever begin
+        int keys[$];
+        rs_group.waitForAnyChange(keys);
+        rs_samples++;
+        assert ((keys.size() == 1) && (rs_group.getProbe(keys[0]) == rs_s) &&
+                (rs_s.getValue32() === rs_samp)) else
+          $display("ERROR: restart sampler reported %0d keys, value %h, expected %h",
+                   keys.size(), rs_s.getValue32(), rs_samp);
+      end
+    join_none
+  end
+
+  initial begin
+    int changes, masked, samples;
+    logic [31:0] values[];
+    longint times[];
+    #1005;
+    changes = rs_changes;
+    masked = rs_masked;
+    samples = rs_samples;
+    #1000;
+    assert (rs_changes - changes == 100) else
+      $display("ERROR: %s saw %0d changes over 100 periods", rs_p.getName(), rs_changes - changes);
+    assert (rs_masked - masked == 25) else
+      $display("ERROR: %s saw %0d changes of bit 2 over 100 periods, expected 25",
+               rs_mask.getName(), rs_masked - masked);
+    assert (rs_samples - samples == 100) else
+      $display("ERROR: restart sampler took %0d samples over 100 periods", rs_samples - samples);
+    assert ((rs_p.getVcEnable() === 1) && (rs_mask.getVcEnable() === 1) && (rs_off.getVcEnable() === 0)) else
+      $display("ERROR: enables are %b %b %b, expected 1 1 0",
+               rs_p.getVcEnable(), rs_mask.getVcEnable(), rs_off.getVcEnable());
+    assert ((rs_p.getHistory(values, times) == 4) && (values[0][7:0] === rs_sig)) else
+      $display("ERROR: %s history has %0d entries, expected 4 ending with %h",
+               rs_p.getName(), values.size(), rs_sig);
+    assert ((rs_p.getKey() != rs_mask.getKey()) && (rs_group.getProbe(rs_s.getKey()) == rs_s)) else
+      $display("ERROR: keys %0d %0d %0d do not match their probes",
+               rs_p.getKey(), rs_mask.getKey(), rs_s.getKey());
+    rs_group.stopSampling();
+  end
+
+  //---------------------------------------------------------------------
+
+  // Count the activity of every probe; the busiest ones are reported
+  // at the end of the simulation.
+  initial signal_probe::setInstrumentation(1);
+
+  initial begin
+    #(`RUNTIME);
+    #100 $display("sig_changes = %0d, detected_changes = %0d, group_changes = %0d",
+                  sig_changes, detected_changes, group_changes);
+    if (posedges != posedges_seen)
+      $display("ERROR: posedges = %0d, posedges_seen = %0d", posedges, posedges_seen);
+    signal_probe::reportNameIndex();
+    $finish;
+  end
+
+endmodule
@@ -1 +0,0 @@
-orig/vlab_probes_pkg.sv
\ No newline at end of file
@@ -0,0 +1,813 @@
+//-----------------------------------------------------------------------------
+// File:        vlab_probes_pkg.sv
+// Author:      Jonathan Bromley, Verilab <jonathan.bromley@verilab.com>
+// Description: SystemVerilog code to implement signal probing by string name
+// Version:     1.0beta, 24 May 2012
+//-----------------------------------------------------------------------------
+// This file is initimately coupled to file libdpi.nim, which
+// implements the Nim side of the signal probing functionality.
+// Users should be concerned ONLY with package vlab_probes_pkg,
+// and the class signal_probe that it contains.  Code in package
+// vlab_probes_pkg_private is, you guessed it, private and should
+// never be touched by user code.
+//
+// Users should import ONLY the signal_probe, signal_probe_group and
+// signal_drive_batch classes, using
+//    import vlab_probes_pkg::signal_probe;
+//    import vlab_probes_pkg::signal_probe_group;
+//    import vlab_probes_pkg::signal_drive_batch;
+// See README and the user documentation for more details.
+//-----------------------------------------------------------------------------
+//
+// Copyright 2012 Verilab GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//-----------------------------------------------------------------------------
+
+// I wish to prevent users from using signal_probe::new() directly.
+// Instead I want them to be forced into using my create() method,
+// which can do various sanity checks before committing to construction
+// of a new object.  This is easily enough achieved by making the
+// constructor "protected", but unfortunately some tools don't yet
+// support that.
+
+`ifdef XCELIUM
+  `define PROTECTED_FUNCTION_NEW function new
+`else
+  `define PROTECTED_FUNCTION_NEW protected function new
+`endif
+
+    // The _private package includes quite a lot of implementation detail, and
+    // in particular it is the only place where the DPI import/export
+    // declarations should appear.  This avoids cluttering of the user's
+    // namespace with a bunch of DPI functions that the user is in any case
+    // not permitted to call.  Into this _private package we put as much of
+    // the "secret" implementation as we are able.
+
+    package vlab_probes_pkg_private;
+
+  timeunit 1ns;
+  timeprecision 1ns;
+
+  import "DPI-C" context function int unsigned vlab_probes_create(input string name, input int sv_key);
+  import "DPI-C" context function int vlab_probes_createMany(input string names[], input int first_key,
+                                                             output int unsigned handles[],
+                                                             output int sizes[], output int signs[]);
+
+  // Set/get value-change callback enable on the chosen signal.
+  import "DPI-C" context function void vlab_probes_setVcEnable(int unsigned hnd, int enable);
+  import "DPI-C" context function int vlab_probes_getVcEnable(int unsigned hnd);
+  import "DPI-C" context function void vlab_probes_setVcEnableMany(input int unsigned handles[], input int enable);
+
+  // Get the signal's value.
+  import "DPI-C" context function int vlab_probes_getValue32(int unsigned hnd, output logic [31:0]value, input int chunk);
+  import "DPI-C" context function int vlab_probes_getValue(int unsigned hnd, output logic [31:0]value[]);
+
+  // Set up and read the signal's value history.
+  import "DPI-C" context function int vlab_probes_setHistoryDepth(int unsigned hnd, int depth);
+  import "DPI-C" context function int vlab_probes_getHistory(int unsigned hnd, output logic [31:0]values[], output longint times[]);
+  import "DPI-C" context function int vlab_probes_getPast(int unsigned hnd, int index, output logic [31:0]value[], output longint t);
+
+  // Choose which value-changes on the signal are passed on to SV.
+  import "DPI-C" context function int vlab_probes_setFilter(int unsigned hnd, int mode,
+                                                            input bit [31:0]mask[], input logic [31:0]value[]);
+
+  // Get the signal's static properties.
+  import "DPI-C" context function int vlab_probes_getSize(int unsigned hnd);
+  import "DPI-C" context function int vlab_probes_getSigned(int unsigned hnd);
+
+  import "DPI-C" context function int vlab_probes_specifyNotifier(string fullname);
+  import "DPI-C" context function void vlab_probes_processChangeList();
+  import "DPI-C" context function void vlab_probes_reportNameIndex();
+  import "DPI-C" context function int vlab_probes_drainChangeList(output int keys[]);
+  import "DPI-C" context function int vlab_probes_setDeliveryMode(int mode);
+  import "DPI-C" context function longint vlab_probes_getNotifyCount();
+
+  // Export value-changes to a worker thread.
+  import "DPI-C" context function int vlab_probes_startExport(string logfile, int capacity, int waitWhenFull);
+  import "DPI-C" context function void vlab_probes_stopExport();
+  import "DPI-C" context function int vlab_probes_getExportStats(output longint stats[]);
+
+  // Periodic sampling of a set of signals.
+  import "DPI-C" context function int unsigned vlab_probes_createSampler(input int unsigned handles[]);
+  import "DPI-C" context function int vlab_probes_startSampler(int unsigned hnd, longint period);
+  import "DPI-C" context function void vlab_probes_stopSampler(int unsigned hnd);
+
+  // Drive many signals in one call.
+  import "DPI-C" context function int vlab_probes_applyPuts(input int unsigned handles[],
+                                                            input logic [31:0] values[],
+                                                            input longint delays[], input int modes[]);
+
+  // Per-signal activity counters and notification latency.
+  import "DPI-C" context function void vlab_probes_setInstrumentation(int enable);
+  import "DPI-C" context function void vlab_probes_reportStats(int topN);
+
+  typedef class signal_probe_private;
+
+  // This task sets up a notifier and then runs an infinite loop that
+  // waits on notifier changes, and for each change services the
+  // pending value-changes (see signal_probe_private::serviceChanges).  By making it
+  // static, we are able to declare a notifier within the task scope;
+  // this makes it easier to find the notifier's string signal name
+  // than it otherwise would be.
+  //
+  task static vlab_probes_run();
+    bit running;
+    bit notifier;  // this is the bit that will be tweaked by VPI
+    string notifier_signal_name;
+    notifier_signal_name = $sformatf("%m.notifier");
+    assert (!running) else
+      $error("vlab_probes_run() called multiple times");
+    assert (!vlab_probes_specifyNotifier(notifier_signal_name)) else
+      $error("vlab_probes_run() failed to register notifier signal %s",
+             notifier_signal_name);
+    running = 1;
+    forever @notifier begin
+      signal_probe_private::serviceChanges();
+    end
+  endtask
+
+  // A group of probes that can be serviced together by a single SV
+  // process.  Every value-change on a member probe is reported to
+  // its group, as well as to the probe itself.
+  virtual class signal_probe_group_private;
+    pure virtual function void notifyKey(int sv_key);
+  endclass
+
+  // This virtual base class contains manipulations of the integer
+  // key that's used to identify each probed signal.  A queue of
+  // probe objects, indexed by that key, provides access to each
+  // object's C access-hook record via an integer handle
+  // stored in the object.
+  virtual class signal_probe_private;
+    pure virtual function void releaseWaiters();
+
+    // ~started~ is used to determine whether a call to signal_probe::create
+    // is the very first such call; if so, some initialization is needed.
+    //
+    protected static bit     started;
+
+    // Unchanging properties of a probed signal.  These properties are
+    // set up once and for all when a probe is created, and do not
+    // change thenceforward.
+    //
+    //       ~signal_name~ is the signal's full string name, exactly as
+    //       supplied to the create() function.
+    protected        string  signal_name;
+    //
+    //       Properties of the signal, determined by VPI inquiries and
+    //       copied once and for all to this object in order to reduce
+    //       future need for DPI calls
+    protected        bit     isSigned;  // 1 = signed, 0 = unsigned
+    protected        int     size;      // vector width (bits)
+    //
+    //       ~handle~ identifies the hook record representing the
+    //       probed signal on the C side.  It packs the record's slot
+    //       number with a generation number, so that a stale handle
+    //       (e.g. from before a simulation reset) is always detected.
+    protected        int unsigned handle;
+    //
+    //       ~event~ is triggered for each value-change on the signal.
+    //       This happens when C code calls DPI export function
+    //       vlab_probes_vcNotify() for this signal.
+    protected        event   change;
+    //
+    //       ~group~ is the group that this probe belongs to, if any.
+    protected        signal_probe_group_private group;
+
+    // The most recent probe created on each signal name.
+    // This array is maintained only to simplify checking for duplicates.
+    // In the unlikely event that we want a list of all probes on a
+    // given named signal, we would have to search exhaustively through
+    // the base class's probes_by_key[] queue.
+    protected static signal_probe_private probes_by_name[string];
+
+    // All the probes that have been created.  The index into
+    // this list is the probe's unique ID key.
+    protected static signal_probe_private probes_by_key[$];
+    protected static function int next_key();
+      return probes_by_key.size();
+    endfunction
+    static function void notify(int sv_key);
+      assert ((sv_key >= 0) && (sv_key < probes_by_key.size())) else
+        $error ("DPI called signal_probe::notify on invalid sv_key %0d", sv_key);
+      probes_by_key[sv_key].releaseWaiters();
+      if (probes_by_key[sv_key].group != null)
+        probes_by_key[sv_key].group.notifyKey(sv_key);
+    endfunction
+    static function void setGroup(int sv_key, signal_probe_group_private group);
+      probes_by_key[sv_key].group = group;
+    endfunction
+    static function signal_probe_group_private getGroup(int sv_key);
+      return probes_by_key[sv_key].group;
+    endfunction
+    static function int unsigned getHandle(int sv_key);
+      return probes_by_key[sv_key].handle;
+    endfunction
+
+    // When ~batched~ is set, the whole changeList is fetched from C in
+    // a single DPI call, rather than C calling back into SV through
+    // DPI export vlab_probes_vcNotify() once per changed signal.
+    // ~changed_keys~ is the buffer that receives the keys; it is kept
+    // at least as big as the number of probes, as each probe can be on
+    // the changeList at most once.
+    protected static bit     batched = 1;
+    protected static int     changed_keys[];
+    static function void serviceChanges();
+      if (batched) begin
+        int n;
+        if (changed_keys.size() < probes_by_key.size())
+          changed_keys = new[probes_by_key.size()];
+        n = vlab_probes_drainChangeList(changed_keys);
+        for (int i = 0; i < n; i++)
+          notify(changed_keys[i]);
+      end
+      else begin
+        vlab_probes_processChangeList();
+      end
+    endfunction
+    `PROTECTED_FUNCTION_NEW ();
+    probes_by_key.push_back(this);
+  endfunction
+  endclass
+
+  // This is the package-level function that is exported via DPI
+  // to be called for each signal_probe object that has a value change.
+  //
+  export "DPI-C" function vlab_probes_vcNotify;
+  //
+  function automatic void vlab_probes_vcNotify(int sv_key);
+    signal_probe_private::notify(sv_key);
+  endfunction
+
+endpackage : vlab_probes_pkg_private
+
+
+  //-----------------------------------------------------------------------------
+
+  // This is the package that users are expected to import or reference.
+  // Note that the ONLY user-visible declaration in it is that of
+  // class signal_probe.  This package imports vlab_probes_pkg_private
+  // but does not re-export any of its contents.
+
+package vlab_probes_pkg;
+
+  timeunit 1ns;
+  timeprecision 1ns;
+
+  import vlab_probes_pkg_private::*;
+
+
+  //////////////////////////////////////////////////////////////////
+  //           class vlab_probes_pkg::signal_probe             //
+  //////////////////////////////////////////////////////////////////
+
+class signal_probe extends signal_probe_private;
+
+  ///////////////////////////////////////////////////////////////
+  //      The following method prototypes form the entire      //
+  //         user-visible API to the class and package.        //
+  ///////////////////////////////////////////////////////////////
+  //
+  // Value-change filters, see setFilter().  The values match the
+  // filter modes of vlab_probes_setFilter().
+  typedef enum int { FILTER_NONE            = 0,
+                     FILTER_POSEDGE         = 1,
+                     FILTER_NEGEDGE         = 2,
+                     FILTER_VALUE_EQUALS    = 3,
+                     FILTER_ANY_BIT_IN_MASK = 4 } filter_e;
+  //
+  // When SV is woken up to service value-changes, see
+  // setDeliveryMode().  The values match vlab_probes_setDeliveryMode().
+  typedef enum int { DELIVER_IMMEDIATE    = 0,
+                     DELIVER_PER_TIMESTEP = 1 } delivery_e;
+  //
+  // Back-pressure statistics of the export ring, see getExportStats().
+  typedef struct { longint pushed;      // changes put into the ring
+                   longint dropped;     // changes dropped, ring full
+                   longint waits;       // changes that waited for room
+                   longint high_water;  // most bytes ever in use
+                   longint consumed;    // changes handled by the worker
+                   longint capacity;    // size of the ring in bytes
+                 } export_stats_t;
+  //
+  extern static  function signal_probe create(string fullname, bit enable = 1);
+  extern static  function void         createMany(string fullnames[], output signal_probe probes[],
+                                                  input bit enable = 1);
+  extern static  function void         setVcEnableMany(int keys[], bit enable);
+  extern static  function void         setBatchedDelivery(bit enable);
+  extern static  function void         setDeliveryMode(delivery_e mode);
+  extern static  function longint      getNotifyCount();
+  extern static  function bit          startExport(string logfile = "", int capacity = 1 << 20,
+                                                   bit waitWhenFull = 0);
+  extern static  function void         stopExport();
+  extern static  function export_stats_t getExportStats();
+  extern static  function void         reportNameIndex();
+  extern static  function void         setInstrumentation(bit enable);
+  extern static  function void         reportStats(int topN = 20);
+  extern virtual task                  waitForChange();
+  extern virtual function logic [31:0] getValue32(int chunk = 0);
+  extern virtual function void         getValue(output logic [31:0] value[]);
+  extern virtual function void         setHistoryDepth(int depth);
+  extern virtual function int          getHistory(output logic [31:0] values[], output longint times[]);
+  extern virtual function bit          getPast(int index, output logic [31:0] value[], output longint t);
+  extern virtual function void         setFilter(filter_e mode, bit [31:0] mask[] = '{},
+                                                 logic [31:0] value[] = '{});
+  extern virtual function string       getName();
+  extern virtual function int          getKey();
+  extern virtual function int          getSize();
+  extern virtual function bit          getSigned();
+  extern virtual function void         setVcEnable(bit enable);
+  extern virtual function bit          getVcEnable();
+  extern virtual function void         releaseWaiters();
+  //
+  ///////////////////////////////////////////////////////////////
+  //      End of user-visible API.  All else is protected      //
+  ///////////////////////////////////////////////////////////////
+
+  extern `PROTECTED_FUNCTION_NEW ();
+  extern protected static function void start();
+
+  protected int key;            // this probe's index in probes_by_key[]
+  protected int history_depth;  // see setHistoryDepth()
+
+endclass
+
+  //////////////////////////////////////////////////////////////////
+  //        class vlab_probes_pkg::signal_probe_group          //
+  //////////////////////////////////////////////////////////////////
+
+  // A signal_probe_group lets one SV process service any number of
+  // probes: waitForAnyChange() blocks until at least one member has
+  // changed, and then returns the keys of all the members that have
+  // changed since the previous call.  Use getProbe() to map a key
+  // back to its probe.  A probe can belong to at most one group.
+
+class signal_probe_group extends signal_probe_group_private;
+
+  ///////////////////////////////////////////////////////////////
+  //                User-visible API of the group              //
+  ///////////////////////////////////////////////////////////////
+  //
+  extern                function              new();
+  extern virtual        function void         add(signal_probe p);
+  extern virtual        task                  waitForAnyChange(output int keys[$]);
+  extern virtual        function signal_probe getProbe(int key);
+  extern virtual        function int          size();
+  extern virtual        function void         setVcEnable(bit enable);
+  extern virtual        function void         startSampling(longint period);
+  extern virtual        function void         stopSampling();
+  //
+  ///////////////////////////////////////////////////////////////
+  //           End of user-visible API of the group            //
+  ///////////////////////////////////////////////////////////////
+
+  extern virtual function void notifyKey(int sv_key);
+
+  protected signal_probe members[int];  // member probes, by key
+  protected int          pending[$];    // keys that changed, not yet collected
+  protected bit          is_pending[int];
+  protected event        change;        // triggered when pending[] becomes non-empty
+  protected int unsigned sampler;       // C-side sampler on the members, 0 if none yet
+
+endclass
+
+  //////////////////////////////////////////////////////////////////
+  //        class vlab_probes_pkg::signal_drive_batch          //
+  //////////////////////////////////////////////////////////////////
+
+  // A signal_drive_batch collects writes to any number of probed
+  // signals, and then applies all of them in a single DPI call, in
+  // the order they were added.  The modes are the vpi_put_value flags.
+
+class signal_drive_batch;
+
+  ///////////////////////////////////////////////////////////////
+  //             User-visible API of the drive batch           //
+  ///////////////////////////////////////////////////////////////
+  //
+  typedef enum int { DRIVE_DEPOSIT          = 1,   // vpiNoDelay
+                     DRIVE_INERTIAL         = 2,   // vpiInertialDelay
+                     DRIVE_TRANSPORT        = 3,   // vpiTransportDelay
+                     DRIVE_PURE_TRANSPORT   = 4,   // vpiPureTransportDelay
+                     DRIVE_FORCE            = 5,   // vpiForceFlag
+                     DRIVE_RELEASE          = 6    // vpiReleaseFlag
+                   } drive_e;
+  //
+  extern                function              new();
+  extern virtual        function void         add(signal_probe p, logic [31:0] value[] = '{},
+                                                  drive_e mode = DRIVE_DEPOSIT, longint delay = 0);
+  extern virtual        function int          apply();
+  extern virtual        function int          size();
+  extern virtual        function void         clear();
+  //
+  ///////////////////////////////////////////////////////////////
+  //        End of user-visible API of the drive batch         //
+  ///////////////////////////////////////////////////////////////
+
+  protected int unsigned handles[$];
+  protected logic [31:0] values[$];   // the words of all the entries, back to back
+  protected longint      delays[$];
+  protected int          modes[$];
+
+endclass
+
+  //////////////////////////////////////////////////////////////////
+  //    Method bodies of class vlab_probes_pkg::signal_probe   //
+  //////////////////////////////////////////////////////////////////
+
+  function signal_probe signal_probe::create(string fullname, bit enable = 1);
+    signal_probe p;
+    int key;
+    int unsigned handle;
+    assert (!probes_by_name.exists(fullname)) else
+      $info("Duplicate signal probe on signal \"%s\"", fullname);
+    start();
+    key = next_key();
+    handle = vlab_probes_create(fullname, key);
+    assert (handle != 0) else
+      $warning("signal_probe::create(\"%s\") could not create probe", fullname, key);
+    if (handle != 0) begin
+      p = new();
+      probes_by_name[fullname] = p;
+      p.signal_name = fullname;
+      p.key = key;
+      p.handle = handle;
+      p.setVcEnable(enable);
+      p.size = vlab_probes_getSize(handle);
+      p.isSigned = (vlab_probes_getSigned(handle) != 0);
+    end
+    else begin
+      p = null;
+    end
+    return p;
+  endfunction
+
+  // Create probes on all the signals named in ~fullnames~ at once.
+  // This costs two DPI calls in all, rather than four per signal as
+  // create() does.  probes[i] is the probe on fullnames[i], or null
+  // if that probe could not be created.
+  function void signal_probe::createMany(string fullnames[], output signal_probe probes[],
+                                         input bit enable = 1);
+    int first_key;
+    int unsigned handles[];
+    int sizes[], signs[];
+    int keys[$];
+    foreach (fullnames[i]) begin
+      assert (!probes_by_name.exists(fullnames[i])) else
+        $info("Duplicate signal probe on signal \"%s\"", fullnames[i]);
+    end
+    start();
+    first_key = next_key();
+    handles = new[fullnames.size()];
+    sizes = new[fullnames.size()];
+    signs = new[fullnames.size()];
+    void'(vlab_probes_createMany(fullnames, first_key, handles, sizes, signs));
+    probes = new[fullnames.size()];
+    foreach (fullnames[i]) begin
+      assert (handles[i] != 0) else
+        $warning("signal_probe::createMany(\"%s\") could not create probe", fullnames[i]);
+      if (handles[i] != 0) begin
+        probes[i] = new();
+        probes_by_name[fullnames[i]] = probes[i];
+        probes[i].signal_name = fullnames[i];
+        probes[i].key = first_key + i;
+        probes[i].handle = handles[i];
+        probes[i].size = sizes[i];
+        probes[i].isSigned = (signs[i] != 0);
+        keys.push_back(first_key + i);
+      end
+      else begin
+        // Keep the key of the missing probe reserved, so that the keys
+        // of the ones after it still match their index in probes_by_key.
+        probes_by_key.push_back(null);
+      end
+    end
+    if (enable)
+      setVcEnableMany(keys, 1);
+  endfunction
+
+  // Enable or disable value-change callbacks on all the probes
+  // whose keys are in ~keys~, in a single DPI call.
+  function void signal_probe::setVcEnableMany(int keys[], bit enable);
+    int unsigned handles[];
+    handles = new[keys.size()];
+    foreach (keys[i])
+      handles[i] = probes_by_key[keys[i]].handle;
+    vlab_probes_setVcEnableMany(handles, enable);
+  endfunction
+
+  function signal_probe::new();
+    super.new();
+  endfunction
+
+  // Start the notifier loop, when the very first probe is created.
+  function void signal_probe::start();
+    if (!started) begin
+      started = 1;
+      fork
+        vlab_probes_run();
+      join_none
+    end
+  endfunction
+
+  function void signal_probe::setBatchedDelivery(bit enable);
+    batched = enable;
+  endfunction
+
+  // Choose when the notifier wakes SV up to service value-changes:
+  //   DELIVER_IMMEDIATE     as soon as the first change is pending
+  //                         (the default); SV can wake up several
+  //                         times in the same time step
+  //   DELIVER_PER_TIMESTEP  once, at the end of each time step with
+  //                         pending changes (cbReadWriteSynch)
+  // The mode can be changed at any time, even before any probe exists.
+  function void signal_probe::setDeliveryMode(delivery_e mode);
+    assert (!vlab_probes_setDeliveryMode(mode)) else
+      $error("vlab_probes_setDeliveryMode(%s) failed", mode.name());
+  endfunction
+
+  // Number of times that SV has been woken up to service value-changes.
+  function longint signal_probe::getNotifyCount();
+    return vlab_probes_getNotifyCount();
+  endfunction
+
+  // Hand every value-change on every enabled probe (that passes its
+  // filter) to a worker thread, with its time and value, through a
+  // lock-free ring buffer of ~capacity~ bytes.  The worker writes a
+  // compact binary log to ~logfile~ (if not empty) and runs any Nim
+  // handlers registered in the library.  When the ring is full, the
+  // change is dropped, or with ~waitWhenFull~ the simulator waits for
+  // the worker.  Needs the library built with NIM_THREADS=1.
+  // Returns 1 if the export started.
+  function bit signal_probe::startExport(string logfile = "", int capacity = 1 << 20,
+                                         bit waitWhenFull = 0);
+    return (vlab_probes_startExport(logfile, capacity, waitWhenFull) == 0);
+  endfunction
+
+  // Stop the export, once the worker has written out what it has.
+  function void signal_probe::stopExport();
+    vlab_probes_stopExport();
+  endfunction
+
+  // Back-pressure statistics, to help choose the size of the ring.
+  function signal_probe::export_stats_t signal_probe::getExportStats();
+    longint stats[];
+    export_stats_t result;
+    stats = new[6];
+    void'(vlab_probes_getExportStats(stats));
+    result.pushed     = stats[0];
+    result.dropped    = stats[1];
+    result.waits      = stats[2];
+    result.high_water = stats[3];
+    result.consumed   = stats[4];
+    result.capacity   = stats[5];
+    return result;
+  endfunction
+
+  function void signal_probe::reportNameIndex();
+    vlab_probes_reportNameIndex();
+  endfunction
+
+  // Keep activity counters for every probe (value-change callbacks,
+  // changeList pushes, notifications and notifier toggles), and a
+  // histogram of the delay between a value-change callback and its
+  // delivery to SV.  While enabled, the busiest probes are reported
+  // at the end of the simulation.
+  function void signal_probe::setInstrumentation(bit enable);
+    vlab_probes_setInstrumentation(enable);
+  endfunction
+
+  // Report the counters of the ~topN~ probes with the most callbacks,
+  // and the latency histogram.
+  function void signal_probe::reportStats(int topN = 20);
+    vlab_probes_reportStats(topN);
+  endfunction
+
+  function void signal_probe::setVcEnable(bit enable);
+    vlab_probes_setVcEnable(handle, enable);
+  endfunction
+
+  function string signal_probe::getName();
+    return signal_name;
+  endfunction
+
+  function int signal_probe::getKey();
+    return key;
+  endfunction
+
+  function bit signal_probe::getVcEnable();
+    return (vlab_probes_getVcEnable(handle) != 0);
+  endfunction
+
+  function logic [31:0] signal_probe::getValue32(int chunk = 0);
+    logic [31:0] value;
+    assert (!vlab_probes_getValue32(handle, value, chunk)) else
+      $error("vlab_probes_getValue32(.chunk(%0d)) on %s failed", chunk, signal_name);
+    return value;
+  endfunction
+
+  // Read the whole signal in a single DPI call.  ~value~ is resized
+  // to hold the signal, least significant 32 bits in value[0].
+  function void signal_probe::getValue(output logic [31:0] value[]);
+    value = new[(size+31)/32];
+    assert (!vlab_probes_getValue(handle, value)) else
+      $error("vlab_probes_getValue() on %s failed", signal_name);
+  endfunction
+
+  // Keep the value and time of the last ~depth~ value-changes on the
+  // signal, collected by the value-change callback itself.  Set
+  // ~depth~ to 0 to stop collecting history.
+  function void signal_probe::setHistoryDepth(int depth);
+    history_depth = depth;
+    assert (!vlab_probes_setHistoryDepth(handle, depth)) else
+      $error("vlab_probes_setHistoryDepth(%0d) on %s failed", depth, signal_name);
+  endfunction
+
+  // Read back the whole value history, most recent change first.
+  // Entry i is in values[i*W] .. values[i*W+W-1], where W is
+  // (getSize()+31)/32, and its time (in simulation precision units)
+  // is in times[i].  Returns the number of entries.
+  function int signal_probe::getHistory(output logic [31:0] values[], output longint times[]);
+    int n;
+    values = new[history_depth * ((size+31)/32)];
+    times = new[history_depth];
+    n = vlab_probes_getHistory(handle, values, times);
+    values = new[n * ((size+31)/32)](values);
+    times = new[n](times);
+    return n;
+  endfunction
+
+  // $past-style access: get the value of the signal after its
+  // ~index~'th most recent change (0 = the latest one), and the time
+  // of that change.  Returns 0 if the history does not go back that far.
+  function bit signal_probe::getPast(int index, output logic [31:0] value[], output longint t);
+    value = new[(size+31)/32];
+    return (vlab_probes_getPast(handle, index, value, t) == 0);
+  endfunction
+
+  // Only wake up waitForChange() (and the probe's group) for the
+  // value-changes that pass the filter:
+  //   FILTER_NONE            every change (the default)
+  //   FILTER_POSEDGE         posedge on the LSB of the signal
+  //   FILTER_NEGEDGE         negedge on the LSB of the signal
+  //   FILTER_VALUE_EQUALS    the bits selected by ~mask~ become equal to ~value~
+  //   FILTER_ANY_BIT_IN_MASK any of the bits selected by ~mask~ changes
+  // ~mask~ and ~value~ are laid out as for getValue(); an empty ~mask~
+  // selects all the bits.  The filter runs in the value-change
+  // callback, so filtered-out changes cost no SV activity at all.
+  function void signal_probe::setFilter(filter_e mode, bit [31:0] mask[] = '{},
+                                        logic [31:0] value[] = '{});
+    assert (!vlab_probes_setFilter(handle, mode, mask, value)) else
+      $error("vlab_probes_setFilter(%s) on %s failed", mode.name(), signal_name);
+  endfunction
+
+  function int signal_probe::getSize();
+    return size;
+  endfunction
+
+  function bit signal_probe::getSigned();
+    return isSigned;
+  endfunction
+
+  task signal_probe::waitForChange();
+    @change;
+  endtask
+
+  function void signal_probe::releaseWaiters();
+    ->change;
+  endfunction
+
+  //////////////////////////////////////////////////////////////////
+  // Method bodies of class vlab_probes_pkg::signal_probe_group //
+  //////////////////////////////////////////////////////////////////
+
+  function signal_probe_group::new();
+  endfunction
+
+  function void signal_probe_group::add(signal_probe p);
+    assert (signal_probe::getGroup(p.getKey()) == null) else
+      $error("signal probe on \"%s\" is already a member of a group", p.getName());
+    members[p.getKey()] = p;
+    signal_probe::setGroup(p.getKey(), this);
+  endfunction
+
+  task signal_probe_group::waitForAnyChange(output int keys[$]);
+    if (pending.size() == 0)
+      @change;
+    keys = pending;
+    pending.delete();
+    is_pending.delete();
+  endtask
+
+  function signal_probe signal_probe_group::getProbe(int key);
+    return members.exists(key) ? members[key] : null;
+  endfunction
+
+  function int signal_probe_group::size();
+    return members.size();
+  endfunction
+
+  function void signal_probe_group::setVcEnable(bit enable);
+    int keys[];
+    int i;
+    keys = new[members.size()];
+    foreach (members[key]) begin
+      keys[i] = key;
+      i++;
+    end
+    signal_probe::setVcEnableMany(keys, enable);
+  endfunction
+
+  // Instead of reacting to every value-change, sample all the members
+  // every ~period~ simulation time units (the simulation precision, as
+  // for signal_probe::getHistory()), and report only the members whose
+  // value differs from the previous sample.  A single timer callback
+  // replaces the value-change callbacks on all the members, which are
+  // disabled.  The members are those of the group when sampling first
+  // starts.  Calling it again changes the period.
+  function void signal_probe_group::startSampling(longint period);
+    int unsigned handles[];
+    int i;
+    if (sampler == 0) begin
+      handles = new[members.size()];
+      foreach (members[key]) begin
+        handles[i] = signal_probe::getHandle(key);
+        i++;
+      end
+      sampler = vlab_probes_createSampler(handles);
+    end
+    assert ((sampler != 0) && !vlab_probes_startSampler(sampler, period)) else
+      $error("signal_probe_group::startSampling(%0d) failed", period);
+  endfunction
+
+  // Stop sampling.  Use setVcEnable(1) to go back to value-change
+  // callbacks on the members.
+  function void signal_probe_group::stopSampling();
+    if (sampler != 0)
+      vlab_probes_stopSampler(sampler);
+  endfunction
+
+  function void signal_probe_group::notifyKey(int sv_key);
+    if (is_pending.exists(sv_key))
+      return;
+    if (pending.size() == 0)
+      ->change;
+    is_pending[sv_key] = 1;
+    pending.push_back(sv_key);
+  endfunction
+
+  //////////////////////////////////////////////////////////////////
+  //  Method bodies of class vlab_probes_pkg::signal_drive_batch   //
+  //////////////////////////////////////////////////////////////////
+
+  function signal_drive_batch::new();
+  endfunction
+
+  // Add a write of ~value~ (laid out as for signal_probe::getValue(),
+  // missing words taken as 0) to the signal of probe ~p~.  ~delay~, in
+  // simulation time units, is only used by the delayed modes.  The
+  // value is ignored by DRIVE_RELEASE.
+  function void signal_drive_batch::add(signal_probe p, logic [31:0] value[] = '{},
+                                        drive_e mode = DRIVE_DEPOSIT, longint delay = 0);
+    handles.push_back(signal_probe::getHandle(p.getKey()));
+    for (int w = 0; w < (p.getSize()+31)/32; w++)
+      values.push_back((w < value.size()) ? value[w] : '0);
+    delays.push_back(delay);
+    modes.push_back(mode);
+  endfunction
+
+  // Apply all the writes, in one DPI call, and empty the batch.
+  // Returns the number of writes that failed.
+  function int signal_drive_batch::apply();
+    int failures;
+    if (handles.size() == 0)
+      return 0;
+    failures = vlab_probes_applyPuts(handles, values, delays, modes);
+    clear();
+    return failures;
+  endfunction
+
+  function int signal_drive_batch::size();
+    return handles.size();
+  endfunction
+
+  function void signal_drive_batch::clear();
+    handles.delete();
+    values.delete();
+    delays.delete();
+    modes.delete();
+  endfunction
+
+endpackage : vlab_probes_pkg